@@ -0,0 +1,183 @@
+// Critical-path analysis of a dependency graph written by
+// `code --depgraph`. Each retired entry is five events -- fetched, issued,
+// began executing, completed, retired -- with edges for in-order fetch,
+// issue and commit, the ROB, instruction queue and stations filling up,
+// register and store-to-load dependences, and fetch restarting after a
+// mispredicted branch, a wrong load value or a JALR. Every event's time is
+// known, so the critical path is the chain of last-arriving edges back from
+// the final retirement. It is followed forwards: each event takes the path
+// of the predecessor that arrived last and adds its wait to that edge's
+// cause. The causes then add up to exactly the cycles of the run. A refetch
+// is charged from the fetch of the instruction that caused it, since a
+// correct guess would have fetched what follows right behind it. Only a
+// window of recent entries is kept, so any length of graph is streamed in
+// flat memory. The core does one instruction a cycle at each stage, so that
+// base cycle of every instruction lands on whichever in-order chain
+// (frontend, issue or commit) the path runs along.
+//
+// usage: critpath [file.dep]   (stdin without a file)
+//
+// Causes:
+//   frontend  fetch bandwidth, predictor bubbles, instruction queue delay
+//   branch    refetch after a mispredicted branch retired
+//   indirect  fetch waiting for a JALR to compute its target
+//   replay    refetch after a mispredicted load value retired
+//   window    ROB, instruction queue, reservation stations or load buffer
+//             full
+//   issue     in-order issue, the free list and waiting for an ALU
+//   data      waiting for a register operand
+//   memory    load latency, store-to-load forwarding, memory ordering
+//   execute   ALU latency and waiting for the CDB
+//   commit    in-order retirement and store write-back
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <initializer_list>
+#include <iostream>
+#include <iomanip>
+#include <queue>
+#include <string>
+#include <vector>
+
+enum Cause { kFrontend, kBranch, kIndirect, kReplay, kWindow, kIssue, kData, kMemory, kExecute, kCommit, kCauses };
+static const char *kCauseName[kCauses] = {"frontend", "branch", "indirect", "replay", "window",
+                                          "issue", "data", "memory", "execute", "commit"};
+
+static const int kKept = 4096; // entries kept; older producers never decide anything
+
+// An event and the cycles of the longest path ending at it, by cause.
+struct Event {
+    long long time = 0;
+    unsigned long long cycles[kCauses] = {};
+};
+
+struct Node {
+    Event fetch, issue, exec, done, commit;
+    unsigned long long seq = 0;
+    char redirect = '-';
+};
+
+struct Edge {
+    const Event *from; // nullptr: no such edge
+    Cause cause;
+    long long at;      // when it arrives, if later than from
+};
+
+// The event at `time`, reached over whichever edge arrived last; earlier
+// edges in the list win ties.
+static void Reach(Event &to, long long time, std::initializer_list<Edge> edges) {
+    const Edge *last = nullptr;
+    auto arrival = [](const Edge &e) { return std::max(e.from->time, e.at); };
+    for (const Edge &e: edges)
+        if (e.from && arrival(e) <= time && (!last || arrival(e) > arrival(*last))) last = &e;
+    to.time = time;
+    std::memcpy(to.cycles, last->from->cycles, sizeof to.cycles);
+    to.cycles[last->cause] += time - last->from->time;
+}
+
+// Reservation stations or load buffer: `size` entries, each held from
+// issue until the result is broadcast (stores and atomics: retirement).
+// In-order issue means the next entry waits for the size-th latest release
+// among the older ones, so those are all that is kept.
+class Stations {
+    struct Later {
+        bool operator()(const Event &a, const Event &b) const { return a.time > b.time; }
+    };
+
+    int size_;
+    std::priority_queue<Event, std::vector<Event>, Later> held_; // copies: they may outlive the window
+
+public:
+    explicit Stations(int size) : size_(size) {}
+
+    // The release an entry issued now waits for, nullptr if none.
+    const Event *Wait() const { return (int) held_.size() < size_ ? nullptr : &held_.top(); }
+
+    void Hold(const Event &release) {
+        held_.push(release);
+        if ((int) held_.size() > size_) held_.pop();
+    }
+};
+
+int main(int argc, char *argv[]) {
+    FILE *in = stdin;
+    if (argc > 2 || (argc == 2 && !(in = fopen(argv[1], "r")))) {
+        std::cerr << (argc > 2 ? "usage: critpath [file.dep]" : std::string("cannot open ") + argv[1]) << '\n';
+        return 1;
+    }
+    static Node ring[kKept];
+    int hart = 0, rob = 32, isq = 32, stations = 6, buffers = 3;
+    long long clock = 0;
+    Event start;
+    Stations rs(stations), lb(buffers);
+    unsigned long long entries = 0, insts = 0;
+    char line[256];
+    while (fgets(line, sizeof line, in)) {
+        if (line[0] == '#') {
+            if (sscanf(line, "# depgraph hart %d rob %d rs %d lb %d isq %d clock %lld", &hart, &rob, &stations,
+                       &buffers, &isq, &clock) == 6) {
+                start.time = clock;
+                rs = Stations(stations);
+                lb = Stations(buffers);
+            }
+            continue;
+        }
+        unsigned long long seq;
+        unsigned pc;
+        char type, redirect;
+        int n;
+        long long commit, fetch, issue, exec, mem, done;
+        unsigned long long src[3];
+        if (sscanf(line, "%llu %x %c %d %lld %lld %lld %lld %lld %lld %llu %llu %llu %c", &seq, &pc, &type, &n,
+                   &commit, &fetch, &issue, &exec, &mem, &done, &src[0], &src[1], &src[2], &redirect) != 14) {
+            std::cerr << "bad line " << entries + 1 << ": " << line;
+            return 1;
+        }
+        unsigned long long i = entries++;
+        insts += n;
+        auto back = [&](unsigned long long d) { return d && d <= i && d < kKept ? &ring[(i - d) % kKept] : nullptr; };
+        Node &node = ring[i % kKept];
+        Node *prev = back(1), *old = back(rob), *queued = nullptr; // old: the ROB entry this one waited for
+        for (unsigned long long d = 1; back(d) && !queued; ++d) // the one whose issue freed its queue slot
+            if (back(d)->seq + isq <= seq) queued = back(d);
+        Node *producer[2] = {back(src[0]), back(src[1])}, *store = back(src[2]);
+        Stations *station = type == 'L' || type == 'S' || type == 'A' ? &lb : strchr("IRB", type) ? &rs : nullptr;
+
+        const Event *restart = nullptr; // when fetch could go on after prev
+        Cause why = kFrontend;
+        if (prev && prev->redirect == 'b') restart = &prev->commit, why = kBranch;
+        else if (prev && prev->redirect == 'v') restart = &prev->commit, why = kReplay;
+        else if (prev && prev->redirect == 'j') restart = &prev->exec, why = kIndirect;
+        Reach(node.fetch, commit - fetch, {{restart ? &prev->fetch : nullptr, why, restart ? restart->time : 0},
+                                           {queued ? &queued->issue : nullptr, kWindow, 0},
+                                           {prev ? &prev->fetch : &start, kFrontend, 0}});
+        Reach(node.issue, commit - issue, {{old ? &old->commit : nullptr, kWindow, 0},
+                                           {station ? station->Wait() : nullptr, kWindow, 0},
+                                           {prev ? &prev->issue : nullptr, kIssue, 0}, {&node.fetch, kFrontend, 0}});
+        Reach(node.exec, commit - exec, {{producer[0] ? &producer[0]->done : nullptr, kData, 0},
+                                         {producer[1] ? &producer[1]->done : nullptr, kData, 0},
+                                         {&node.issue, kIssue, 0}});
+        Event memory;
+        Reach(memory, commit - mem, {{store ? &store->done : nullptr, kMemory, 0}, {&node.exec, kMemory, 0}});
+        Reach(node.done, commit - done, {{&memory, type == 'L' ? kMemory : kExecute, 0}});
+        Reach(node.commit, commit, {{prev ? &prev->commit : nullptr, kCommit, 0}, {&node.done, kCommit, 0}});
+        if (station) station->Hold(type == 'S' || type == 'A' ? node.commit : node.done);
+        node.seq = seq;
+        node.redirect = redirect;
+    }
+    if (!entries) {
+        std::cerr << "no retired instructions\n";
+        return 1;
+    }
+    const Event &end = ring[(entries - 1) % kKept].commit;
+    long long cycles = end.time - start.time;
+    std::cout << "hart " << hart << ": " << insts << " instructions in " << entries << " entries, " << cycles
+              << " cycles on the critical path (ipc " << std::fixed << std::setprecision(4)
+              << (cycles ? 1.0 * insts / cycles : 0.0) << ")\n";
+    for (int c = 0; c < kCauses; ++c)
+        std::cout << std::left << std::setw(10) << kCauseName[c] << std::right << std::setw(14) << end.cycles[c]
+                  << std::setw(9) << std::setprecision(2) << (cycles ? 100.0 * end.cycles[c] / cycles : 0.0)
+                  << "%\n";
+    return 0;
+}
@@ -0,0 +1,366 @@
+// Decoder microbenchmark: checks that the table-driven Decode agrees with the
+// old bit-slicing decoder on every word of a corpus, then times both.
+//
+// usage: decode_bench [--words N] [--exhaustive] [file.data ...]
+//   corpus = the instruction words of the given .data files plus N (default
+//   16M) pseudo-random words biased towards valid RV32I/RV32A opcodes.
+//   --exhaustive additionally checks all 2^32 encodings.
+
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <sstream>
+#include <vector>
+#include "../src/decode.h"
+
+// Decode as it was before the lookup tables, kept as the reference.
+class LegacyDecode {
+public:
+    char type_ = 0;
+    u_int32_t order_ = 0;
+    RV32I_Order op_ = NOPE;
+    u_int32_t imm_ = 0;
+    u_int8_t rd_ = 0, rs1_ = 0, rs2_ = 0;
+    u_int8_t funct3_ = 0, funct7_ = 0;
+public:
+    void SetOrder(u_int32_t &order) {
+        order_ = order;
+    }
+
+private:
+    u_int32_t substr(u_int32_t str, int l, int r) {
+        if (r < 31) str = str & ((1 << (r + 1)) - 1);
+        return str >> l;
+    }
+
+public:
+    u_int32_t sext(u_int32_t data, int len = 32) {
+        if (len == 32) return data;
+        u_int32_t ext = (data >> (len - 1)) & 1 ? (0xffffffff >> len << len) : 0;
+        return data | ext;
+    }
+
+private:
+    u_int8_t get_opcode() { return substr(order_, 0, 6); }
+
+    u_int8_t get_rd() { return substr(order_, 7, 11); }
+
+    u_int8_t get_rs1() { return substr(order_, 15, 19); }
+
+    u_int8_t get_rs2() { return substr(order_, 20, 24); }
+
+    u_int8_t get_funct3() { return substr(order_, 12, 14); }
+
+    u_int8_t get_funct7() { return substr(order_, 25, 31); }
+
+    u_int32_t get_imm_I() { return sext(substr(order_, 20, 31), 12); }
+
+    u_int32_t get_imm_Ij() { return sext(substr(order_, 20, 31) << 1, 13); }
+
+    u_int32_t get_imm_Iu() { return substr(order_, 20, 31); }
+
+    u_int32_t get_imm_U() { return sext(substr(order_, 12, 31) << 12); }
+
+    u_int32_t get_imm_J() {
+        u_int32_t imm = 0;
+        imm |= substr(order_, 21, 30) << 1;
+        imm |= substr(order_, 20, 20) << 11;
+        imm |= substr(order_, 12, 19) << 12;
+        imm |= substr(order_, 31, 31) << 20;
+        return sext(imm, 21);
+    }
+
+    u_int32_t get_imm_B() {
+        u_int32_t imm = 0;
+        imm |= substr(order_, 8, 11) << 1;
+        imm |= substr(order_, 25, 30) << 5;
+        imm |= substr(order_, 7, 7) << 11;
+        imm |= substr(order_, 31, 31) << 12;
+        return sext(imm, 13);
+    }
+
+    u_int32_t get_imm_S() {
+        u_int32_t imm = 0;
+        imm |= substr(order_, 7, 11);
+        imm |= substr(order_, 25, 31) << 5;
+        return sext(imm, 12);
+    }
+
+public:
+    void decode() {
+        u_int8_t opt;
+        opt = get_opcode();
+        switch (opt) {
+            case 0x37:
+                type_ = 'U';
+                op_ = LUI;
+                rd_ = get_rd();
+                imm_ = get_imm_U();
+                break;
+            case 0x17:
+                type_ = 'U';
+                op_ = AUIPC;
+                rd_ = get_rd();
+                imm_ = get_imm_U();
+                break;
+            case 0x6f:
+                type_ = 'J';
+                op_ = JAL;
+                rd_ = get_rd();
+                imm_ = get_imm_J();
+                break;
+            case 0x67:
+                type_ = 'I';
+                op_ = JALR;
+                rd_ = get_rd();
+                rs1_ = get_rs1();
+                imm_ = get_imm_Ij();
+                break;
+            case 0x63:
+                type_ = 'B';
+                funct3_ = get_funct3();
+                rs1_ = get_rs1();
+                rs2_ = get_rs2();
+                imm_ = get_imm_B();
+                switch (funct3_) {
+                    case 0:
+                        op_ = BEQ;
+                        break;
+                    case 1:
+                        op_ = BNE;
+                        break;
+                    case 4:
+                        op_ = BLT;
+                        break;
+                    case 5:
+                        op_ = BGE;
+                        break;
+                    case 6:
+                        op_ = BLTU;
+                        break;
+                    case 7:
+                        op_ = BGEU;
+                        break;
+                }
+                break;
+            case 0x03:
+                type_ = 'L';
+                funct3_ = get_funct3();
+                rd_ = get_rd();
+                rs1_ = get_rs1();
+                imm_ = get_imm_I();
+                switch (funct3_) {
+                    case 0:
+                        op_ = LB;
+                        break;
+                    case 1:
+                        op_ = LH;
+                        break;
+                    case 2:
+                        op_ = LW;
+                        break;
+                    case 4:
+                        op_ = LBU;
+                        break;
+                    case 5:
+                        op_ = LHU;
+                        break;
+                }
+                break;
+            case 0x23:
+                type_ = 'S';
+                funct3_ = get_funct3();
+                rs1_ = get_rs1();
+                rs2_ = get_rs2();
+                imm_ = get_imm_S();
+                switch (funct3_) {
+                    case 0:
+                        op_ = SB;
+                        break;
+                    case 1:
+                        op_ = SH;
+                        break;
+                    case 2:
+                        op_ = SW;
+                        break;
+                }
+                break;
+            case 0x13:
+                type_ = 'I';
+                funct3_ = get_funct3();
+                rd_ = get_rd();
+                rs1_ = get_rs1();
+                switch (funct3_) {
+                    case 0:
+                        op_ = ADDI;
+                        imm_ = get_imm_I();
+                        break;
+                    case 2:
+                        op_ = SLTI;
+                        imm_ = get_imm_I();
+                        break;
+                    case 3:
+                        op_ = SLTIU;
+                        imm_ = get_imm_I();
+                        break;
+                    case 4:
+                        op_ = XORI;
+                        imm_ = get_imm_I();
+                        break;
+                    case 6:
+                        op_ = ORI;
+                        imm_ = get_imm_I();
+                        break;
+                    case 7:
+                        op_ = ANDI;
+                        imm_ = get_imm_I();
+                        break;
+                    case 1:
+                        op_ = SLLI;
+                        imm_ = get_imm_Iu();
+                        break;
+                    case 5:
+                        imm_ = get_imm_Iu();
+                        op_ = ((imm_ >> 10) & 1) ? SRAI : SRLI;
+                        break;
+                }
+                if (op_ == SRAI) imm_ = imm_ << 2 >> 2;
+                break;
+            case 0x33:
+                type_ = 'R';
+                funct3_ = get_funct3();
+                rd_ = get_rd();
+                rs1_ = get_rs1();
+                rs2_ = get_rs2();
+                funct7_ = get_funct7();
+                switch (funct3_) {
+                    case 0:
+                        op_ = ((funct7_ >> 5) & 1) ? SUB : ADD;
+                        break;
+                    case 1:
+                        op_ = SLL;
+                        break;
+                    case 2:
+                        op_ = SLT;
+                        break;
+                    case 3:
+                        op_ = SLTU;
+                        break;
+                    case 4:
+                        op_ = XOR;
+                        break;
+                    case 5:
+                        op_ = ((funct7_ >> 5) & 1) ? SRA : SRL;
+                        break;
+                    case 6:
+                        op_ = OR;
+                        break;
+                    case 7:
+                        op_ = AND;
+                        break;
+                }
+                break;
+            case 0x2f:
+                if (get_funct3() != 2) break;
+                type_ = 'A';
+                funct3_ = get_funct3();
+                rd_ = get_rd();
+                rs1_ = get_rs1();
+                rs2_ = get_rs2();
+                funct7_ = get_funct7();
+                op_ = AtomicOp(funct7_ >> 2);
+                break;
+        }
+    }
+};
+
+
+static bool Same(const Decode &a, const LegacyDecode &b) {
+    return a.type_ == b.type_ && a.op_ == b.op_ && a.imm_ == b.imm_ && a.rd_ == b.rd_ &&
+           a.rs1_ == b.rs1_ && a.rs2_ == b.rs2_ && a.funct3_ == b.funct3_ && a.funct7_ == b.funct7_;
+}
+
+static bool Check(u_int32_t order) {
+    Decode now;
+    LegacyDecode old;
+    now.SetOrder(order);
+    now.decode();
+    old.SetOrder(order);
+    old.decode();
+    if (Same(now, old)) return true;
+    std::cerr << "mismatch on " << std::hex << order << ": op " << std::dec << now.op_ << '/' << old.op_
+              << " imm " << std::hex << now.imm_ << '/' << old.imm_ << '\n';
+    return false;
+}
+
+static void ReadData(const char *path, std::vector<u_int32_t> &corpus) {
+    std::ifstream in(path);
+    std::string token;
+    u_int32_t word = 0;
+    int bytes = 0;
+    while (in >> token) {
+        if (token[0] == '@') {
+            bytes = word = 0;
+            continue;
+        }
+        u_int32_t b;
+        std::stringstream(token) >> std::hex >> b;
+        word |= b << (8 * bytes);
+        if (++bytes == 4) {
+            corpus.push_back(word);
+            bytes = word = 0;
+        }
+    }
+}
+
+template<class D>
+static double Time(const std::vector<u_int32_t> &corpus, u_int64_t &sum) {
+    auto begin = std::chrono::steady_clock::now();
+    for (u_int32_t order: corpus) {
+        D decoder;
+        decoder.SetOrder(order);
+        decoder.decode();
+        sum += decoder.op_ + decoder.imm_ + decoder.type_ + decoder.rd_ + decoder.rs1_ + decoder.rs2_;
+    }
+    auto end = std::chrono::steady_clock::now();
+    return std::chrono::duration<double, std::nano>(end - begin).count() / corpus.size();
+}
+
+int main(int argc, char *argv[]) {
+    std::vector<u_int32_t> corpus;
+    u_int64_t words = 1 << 24;
+    bool exhaustive = false;
+    for (int i = 1; i < argc; ++i) {
+        if (!strcmp(argv[i], "--words") && i + 1 < argc) words = std::stoull(argv[++i]);
+        else if (!strcmp(argv[i], "--exhaustive")) exhaustive = true;
+        else ReadData(argv[i], corpus);
+    }
+    static const u_int32_t opcodes[] = {0x37, 0x17, 0x6f, 0x67, 0x63, 0x03, 0x23, 0x13, 0x33, 0x2f};
+    u_int32_t x = 2463534242u;
+    for (u_int64_t i = 0; i < words; ++i) {
+        x ^= x << 13, x ^= x >> 17, x ^= x << 5;
+        corpus.push_back((i & 7) ? (x & ~0x7fu) | opcodes[x % (sizeof opcodes / sizeof *opcodes)] : x);
+    }
+
+    u_int64_t bad = 0;
+    for (u_int32_t order: corpus) bad += !Check(order);
+    if (exhaustive) {
+        u_int32_t order = 0;
+        do bad += !Check(order); while (++order);
+    }
+    if (bad) {
+        std::cout << bad << " mismatches\n";
+        return 1;
+    }
+
+    u_int64_t sumOld = 0, sumNew = 0;
+    double old = Time<LegacyDecode>(corpus, sumOld);
+    double now = Time<Decode>(corpus, sumNew);
+    std::cout << "words          " << corpus.size() << '\n'
+              << std::fixed << std::setprecision(2)
+              << "legacy decode  " << old << " ns/word\n"
+              << "table decode   " << now << " ns/word\n"
+              << "speedup        " << old / now << "x\n";
+    return sumOld == sumNew ? 0 : 1;
+}
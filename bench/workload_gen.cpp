@@ -0,0 +1,305 @@
+// Synthetic workload generator: emits an RV32I loop whose instruction mix,
+// ILP, branch entropy, memory footprint/stride and store-load aliasing are
+// set one knob at a time, in the .data format the simulator reads. The
+// program is run on the functional core to get the expected a0, which is
+// printed to stdout (so `bench_runner ... --no-golden --case w.data
+// $(workload_gen ...)` works); the achieved dynamic mix goes to stderr.
+//
+// usage: workload_gen [options] -o file.data
+//   --insts N          dynamic instructions to aim for (default 1M)
+//   --body N           operations in the loop body, 1..128 (default 32)
+//   --mix a,l,s,b      relative weights of ALU ops, loads, stores and
+//                      branches in the body (default 6,2,1,1)
+//   --chains K         independent dependency chains the ops rotate over,
+//                      1 (fully serial) .. 15 (default 4)
+//   --branch-entropy E fraction of branches that test a fresh random bit,
+//                      0..1; the rest follow a short periodic pattern of
+//                      the loop counter (default 0.5)
+//   --footprint B      bytes of data touched, a power of two from 4 to 8M
+//                      (default 64K)
+//   --stride B         bytes between consecutive accesses, a multiple of 4
+//                      (default 64)
+//   --alias A          fraction of loads that read the address the latest
+//                      store wrote, where a store precedes them in the
+//                      body, 0..1 (default 0)
+//   --seed N           generator seed (default 1)
+//
+// Every load or store costs three extra ALU instructions to step the
+// address, and a load one more to fold the value into its chain; the loop
+// itself adds eight per iteration (random bits and the counter).
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+#include "../src/functional.h"
+
+static const int kMemSize = 0x1000000;  // as the simulator's memory
+static const int kMaxBody = 128;        // keeps the back edge within a branch's reach
+static const u_int32_t kHalt = 0x0ff00513u;
+
+// Register roles. The chains use whatever is left.
+enum Reg {
+    kBase = 8,     // s0: data base, aligned to the footprint
+    kMask = 18,    // s2: footprint - 1
+    kRandom = 19,  // s3: xorshift state, one step per iteration
+    kCount = 20,   // s4: iterations left
+    kStride = 21,  // s5
+    kAddr = 22,    // s6: address of the latest access
+    kLoaded = 23,  // s7
+    kTest = 24,    // s8: branch condition
+    kScratch = 25, // s9
+    kConstA = 26,  // s10/s11: second operands of the R-type ALU ops
+    kConstB = 27,
+};
+static const int kChainRegs[] = {11, 12, 13, 14, 15, 16, 17, 5, 6, 7, 28, 29, 30, 31, 9};
+static const int kMaxChains = sizeof kChainRegs / sizeof *kChainRegs;
+
+class Rng {
+    u_int32_t x_;
+public:
+    explicit Rng(u_int32_t seed) : x_(seed * 2654435761u ^ 2463534242u) { if (!x_) x_ = 1; }
+
+    u_int32_t Next() {
+        x_ ^= x_ << 13, x_ ^= x_ >> 17, x_ ^= x_ << 5;
+        return x_;
+    }
+
+    double Uniform() { return (Next() >> 8) / 16777216.0; }
+
+    int Below(int n) { return Next() % n; }
+};
+
+class Assembler {
+public:
+    std::vector<u_int32_t> code_;
+
+    u_int32_t Here() const { return code_.size() * 4; }
+
+    void R(u_int32_t funct7, int rs2, int rs1, u_int32_t funct3, int rd) {
+        code_.push_back(funct7 << 25 | rs2 << 20 | rs1 << 15 | funct3 << 12 | rd << 7 | 0x33);
+    }
+
+    void I(int32_t imm, int rs1, u_int32_t funct3, int rd, u_int32_t opcode = 0x13) {
+        code_.push_back((u_int32_t) (imm & 0xfff) << 20 | rs1 << 15 | funct3 << 12 | rd << 7 | opcode);
+    }
+
+    void S(int32_t imm, int rs2, int rs1, u_int32_t funct3) {
+        u_int32_t u = imm & 0xfff;
+        code_.push_back((u >> 5) << 25 | rs2 << 20 | rs1 << 15 | funct3 << 12 | (u & 31) << 7 | 0x23);
+    }
+
+    void B(int32_t offset, int rs2, int rs1, u_int32_t funct3) {
+        u_int32_t u = offset & 0x1fff;
+        code_.push_back((u >> 12 & 1) << 31 | (u >> 5 & 63) << 25 | rs2 << 20 | rs1 << 15 | funct3 << 12 |
+                        (u >> 1 & 15) << 8 | (u >> 11 & 1) << 7 | 0x63);
+    }
+
+    void Lui(u_int32_t upper, int rd) { code_.push_back((upper & 0xfffff) << 12 | rd << 7 | 0x37); }
+
+    void Li(int rd, u_int32_t value) {
+        u_int32_t upper = (value + 0x800) >> 12;
+        int32_t lower = (int32_t) (value - (upper << 12));
+        if (upper) Lui(upper, rd);
+        if (lower || !upper) I(lower, upper ? rd : 0, 0, rd);
+    }
+
+    void Add(int rd, int rs1, int rs2) { R(0, rs2, rs1, 0, rd); }
+    void Xor(int rd, int rs1, int rs2) { R(0, rs2, rs1, 4, rd); }
+    void Or(int rd, int rs1, int rs2) { R(0, rs2, rs1, 6, rd); }
+    void And(int rd, int rs1, int rs2) { R(0, rs2, rs1, 7, rd); }
+    void Addi(int rd, int rs1, int32_t imm) { I(imm, rs1, 0, rd); }
+    void Andi(int rd, int rs1, int32_t imm) { I(imm, rs1, 7, rd); }
+    void Slli(int rd, int rs1, int shamt) { I(shamt, rs1, 1, rd); }
+    void Srli(int rd, int rs1, int shamt) { I(shamt, rs1, 5, rd); }
+    void Lw(int rd, int rs1) { I(0, rs1, 2, rd, 0x03); }
+    void Sw(int rs2, int rs1) { S(0, rs2, rs1, 2); }
+};
+
+struct Knobs {
+    u_int64_t insts = 1 << 20;
+    int body = 32;
+    int mix[4] = {6, 2, 1, 1}; // ALU, load, store, branch
+    int chains = 4;
+    double entropy = 0.5;
+    u_int32_t footprint = 1 << 16;
+    u_int32_t stride = 64;
+    double alias = 0;
+    u_int32_t seed = 1;
+};
+
+enum Kind { kAlu, kLoad, kStore, kBranch };
+
+// The body's operations in program order.
+static std::vector<Kind> Plan(const Knobs &k, Rng &rng) {
+    int total = k.mix[0] + k.mix[1] + k.mix[2] + k.mix[3];
+    std::vector<Kind> plan;
+    for (int i = 0, acc[4] = {}; i < k.body; ++i) {
+        // Largest deficit first keeps every prefix close to the mix.
+        int best = 0;
+        for (int j = 1; j < 4; ++j)
+            if ((int64_t) (i + 1) * k.mix[j] - (int64_t) acc[j] * total >
+                (int64_t) (i + 1) * k.mix[best] - (int64_t) acc[best] * total)
+                best = j;
+        ++acc[best];
+        plan.push_back((Kind) best);
+    }
+    for (int i = plan.size() - 1; i > 0; --i) std::swap(plan[i], plan[rng.Below(i + 1)]);
+    return plan;
+}
+
+static void Generate(const Knobs &k, Assembler &a, Rng &rng, u_int32_t base) {
+    for (int c = 0; c < k.chains; ++c) a.Li(kChainRegs[c], rng.Next());
+    a.Li(kBase, base);
+    a.Li(kMask, k.footprint - 1);
+    a.Li(kStride, k.stride);
+    a.Li(kRandom, rng.Next() | 1);
+    a.Li(kConstA, rng.Next());
+    a.Li(kConstB, rng.Next() | 1);
+    a.Addi(kAddr, kBase, 0);
+
+    std::vector<Kind> plan = Plan(k, rng);
+    int perIteration = 8;
+    for (Kind op: plan) perIteration += op == kLoad ? 5 : op == kStore ? 4 : op == kBranch ? 3 : 1;
+    u_int64_t iterations = k.insts / perIteration;
+    a.Li(kCount, iterations ? iterations : 1);
+
+    u_int32_t loop = a.Here();
+    a.Slli(kScratch, kRandom, 13), a.Xor(kRandom, kRandom, kScratch);
+    a.Srli(kScratch, kRandom, 17), a.Xor(kRandom, kRandom, kScratch);
+    a.Slli(kScratch, kRandom, 5), a.Xor(kRandom, kRandom, kScratch);
+    int chain = 0, bit = 0;
+    bool stored = false; // kAddr still holds the latest store's address
+    for (Kind op: plan) {
+        int rd = kChainRegs[chain];
+        chain = (chain + 1) % k.chains;
+        switch (op) {
+            case kAlu:
+                switch (rng.Below(6)) {
+                    case 0: a.Add(rd, rd, kConstA); break;
+                    case 1: a.R(0x20, kConstB, rd, 0, rd); break; // sub
+                    case 2: a.Xor(rd, rd, kConstB); break;
+                    case 3: a.Addi(rd, rd, rng.Below(4096) - 2048); break;
+                    case 4: a.I(rng.Below(4096) - 2048, rd, 4, rd); break; // xori
+                    default: a.Slli(rd, rd, 1 + rng.Below(3)); break;
+                }
+                break;
+            case kLoad:
+                if (!stored || rng.Uniform() >= k.alias) {
+                    a.Add(kAddr, kAddr, kStride), a.And(kAddr, kAddr, kMask), a.Or(kAddr, kAddr, kBase);
+                    stored = false;
+                }
+                a.Lw(kLoaded, kAddr);
+                a.Add(rd, rd, kLoaded);
+                break;
+            case kStore:
+                a.Add(kAddr, kAddr, kStride), a.And(kAddr, kAddr, kMask), a.Or(kAddr, kAddr, kBase);
+                a.Sw(rd, kAddr);
+                stored = true;
+                break;
+            case kBranch:
+                // Taken skips the increment: a random bit, or bit 0..2 of the
+                // counter (period 2, 4 or 8).
+                if (rng.Uniform() < k.entropy) a.Andi(kTest, kRandom, 1 << (bit++ % 11));
+                else a.Andi(kTest, kCount, 1 << rng.Below(3));
+                a.B(8, 0, kTest, 0); // beq
+                a.Addi(rd, rd, 1);
+                break;
+        }
+    }
+    a.Addi(kCount, kCount, -1);
+    a.B((int32_t) (loop - a.Here()), 0, kCount, 1); // bne
+
+    a.Addi(10, kChainRegs[0], 0);
+    for (int c = 1; c < k.chains; ++c) a.Add(10, 10, kChainRegs[c]);
+    a.Srli(kScratch, 10, 16), a.Xor(10, 10, kScratch);
+    a.Srli(kScratch, 10, 8), a.Xor(10, 10, kScratch);
+    a.code_.push_back(kHalt);
+}
+
+static void WriteBytes(std::ostream &out, u_int32_t addr, const std::vector<u_int32_t> &words) {
+    out << '@' << std::hex << std::uppercase << std::setw(8) << std::setfill('0') << addr << '\n';
+    for (size_t i = 0; i < words.size() * 4; ++i)
+        out << std::setw(2) << (words[i / 4] >> (8 * (i % 4)) & 255) << ((i % 16 == 15) ? '\n' : ' ');
+    out << std::dec << '\n';
+}
+
+static bool PowerOfTwo(u_int32_t x) { return x && !(x & (x - 1)); }
+
+int main(int argc, char *argv[]) {
+    Knobs k;
+    const char *path = nullptr;
+    for (int i = 1; i < argc; ++i) {
+        if (!strcmp(argv[i], "-o") && i + 1 < argc) path = argv[++i];
+        else if (!strcmp(argv[i], "--insts") && i + 1 < argc) k.insts = std::stoull(argv[++i]);
+        else if (!strcmp(argv[i], "--body") && i + 1 < argc) k.body = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--mix") && i + 1 < argc) {
+            if (sscanf(argv[++i], "%d,%d,%d,%d", &k.mix[0], &k.mix[1], &k.mix[2], &k.mix[3]) != 4) k.mix[0] = -1;
+        } else if (!strcmp(argv[i], "--chains") && i + 1 < argc) k.chains = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--branch-entropy") && i + 1 < argc) k.entropy = atof(argv[++i]);
+        else if (!strcmp(argv[i], "--footprint") && i + 1 < argc) k.footprint = strtoul(argv[++i], nullptr, 0);
+        else if (!strcmp(argv[i], "--stride") && i + 1 < argc) k.stride = strtoul(argv[++i], nullptr, 0);
+        else if (!strcmp(argv[i], "--alias") && i + 1 < argc) k.alias = atof(argv[++i]);
+        else if (!strcmp(argv[i], "--seed") && i + 1 < argc) k.seed = strtoul(argv[++i], nullptr, 0);
+        else {
+            std::cerr << "unknown option " << argv[i] << '\n';
+            return 2;
+        }
+    }
+    if (!path || k.body < 1 || k.body > kMaxBody || k.chains < 1 || k.chains > kMaxChains ||
+        k.mix[0] < 0 || k.mix[1] < 0 || k.mix[2] < 0 || k.mix[3] < 0 ||
+        k.mix[0] + k.mix[1] + k.mix[2] + k.mix[3] == 0 || k.entropy < 0 || k.entropy > 1 ||
+        k.alias < 0 || k.alias > 1 || !PowerOfTwo(k.footprint) || k.footprint < 4 ||
+        k.footprint > (kMemSize >> 1) || k.stride % 4) {
+        std::cerr << "usage: workload_gen [--insts N] [--body 1..128] [--mix alu,load,store,branch]"
+                     " [--chains 1..15] [--branch-entropy 0..1] [--footprint pow2 4..8M]"
+                     " [--stride 4k] [--alias 0..1] [--seed N] -o file.data\n";
+        return 2;
+    }
+
+    // Data above the code, aligned so that or-ing the base in wraps addresses.
+    u_int32_t base = k.footprint > (1u << 20) ? k.footprint : 1u << 20;
+    Rng rng(k.seed);
+    Assembler a;
+    Generate(k, a, rng, base);
+    std::vector<u_int32_t> data(k.footprint / 4);
+    for (auto &w: data) w = rng.Next();
+
+    auto *memory = new Memory<kMemSize>;
+    for (size_t i = 0; i < a.code_.size(); ++i) memory->writeWord(i * 4, a.code_[i]);
+    for (size_t i = 0; i < data.size(); ++i) memory->writeWord(base + i * 4, data[i]);
+    auto *core = new FunctionalCore<kMemSize>(*memory);
+    u_int64_t count[4] = {}, aliased = 0;
+    u_int32_t lastStore = ~0u;
+    while (!core->Halted()) {
+        Decode decoder;
+        u_int32_t order = memory->readWord(core->ctx_.pc);
+        decoder.SetOrder(order);
+        decoder.decode();
+        if (decoder.type_ == 'L') ++count[kLoad], aliased += core->ctx_.reg[decoder.rs1_] == lastStore;
+        else if (decoder.type_ == 'B') ++count[kBranch];
+        else if (decoder.type_ == 'S') ++count[kStore];
+        else ++count[kAlu];
+        u_int32_t store = core->Step();
+        if (store != (u_int32_t) kMemSize) lastStore = store;
+    }
+
+    std::ofstream out(path);
+    WriteBytes(out, 0, a.code_);
+    WriteBytes(out, base, data);
+    if (!out) {
+        std::cerr << "cannot write " << path << '\n';
+        return 1;
+    }
+    u_int64_t total = count[0] + count[1] + count[2] + count[3];
+    std::cerr << std::fixed << std::setprecision(1) << "instructions " << total
+              << "  alu " << 100.0 * count[kAlu] / total << "%  load " << 100.0 * count[kLoad] / total
+              << "%  store " << 100.0 * count[kStore] / total << "%  branch " << 100.0 * count[kBranch] / total
+              << "%  aliased loads " << (count[kLoad] ? 100.0 * aliased / count[kLoad] : 0.0) << "%\n";
+    std::cout << core->Result() << '\n';
+    return 0;
+}
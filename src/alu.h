@@ -3,9 +3,25 @@
 
 #include <iostream>
 #include "utils.h"
+#if defined(__x86_64__) && defined(__GNUC__)
+#include <immintrin.h>
+#endif
 
 class ALU {
 public:
+    static const int kLanes = 8; // 32-bit lanes of an AVX2 register
+
+    // calc on kLanes operand pairs at once, as AVX2 vector operations when
+    // the host has them. Shift amounts are taken mod 32 either way, as the
+    // scalar shifts do on x86.
+    void calcLanes(RV32I_Order op, const u_int32_t *r1, const u_int32_t *r2, u_int32_t *out) {
+#if defined(__x86_64__) && defined(__GNUC__)
+        static const bool avx2 = __builtin_cpu_supports("avx2");
+        if (avx2 && calcLanesAvx2(op, r1, r2, out)) return;
+#endif
+        for (int l = 0; l < kLanes; ++l) out[l] = calc(op, r1[l], r2[l]);
+    }
+
     u_int32_t calc(RV32I_Order op, u_int32_t r1, u_int32_t r2) {
         switch (op) {
             case NOPE:
@@ -54,6 +70,35 @@ public:
             case SRAI:
             case SRA:
                 return (int32_t) r1 >> r2;
+            case SH1ADD:
+                return (r1 << 1) + r2;
+            case SH2ADD:
+                return (r1 << 2) + r2;
+            case SH3ADD:
+                return (r1 << 3) + r2;
+
+            // read-modify-write of an AMO: r1 is the old memory word, r2 rs2
+            case LR_W:
+                return r1;
+            case SC_W:
+            case AMOSWAP_W:
+                return r2;
+            case AMOADD_W:
+                return r1 + r2;
+            case AMOXOR_W:
+                return r1 ^ r2;
+            case AMOAND_W:
+                return r1 & r2;
+            case AMOOR_W:
+                return r1 | r2;
+            case AMOMIN_W:
+                return (int32_t) r1 < (int32_t) r2 ? r1 : r2;
+            case AMOMAX_W:
+                return (int32_t) r1 > (int32_t) r2 ? r1 : r2;
+            case AMOMINU_W:
+                return r1 < r2 ? r1 : r2;
+            case AMOMAXU_W:
+                return r1 > r2 ? r1 : r2;
 
             case LB:
             case LH:
@@ -67,6 +112,99 @@ public:
         }
         return 0;
     }
+
+private:
+#if defined(__x86_64__) && defined(__GNUC__)
+    // False for the ops left to the scalar loop (memory side of atomics).
+    __attribute__((target("avx2")))
+    static bool calcLanesAvx2(RV32I_Order op, const u_int32_t *r1, const u_int32_t *r2, u_int32_t *out) {
+        __m256i a = _mm256_loadu_si256((const __m256i *) r1), b = _mm256_loadu_si256((const __m256i *) r2);
+        __m256i one = _mm256_set1_epi32(1), sign = _mm256_set1_epi32((int) 0x80000000u);
+        __m256i shamt = _mm256_and_si256(b, _mm256_set1_epi32(31)), r;
+        switch (op) {
+            case LUI:
+            case AUIPC:
+            case JAL:
+            case ADDI:
+            case ADD:
+            case LB:
+            case LH:
+            case LW:
+            case LBU:
+            case LHU:
+            case SB:
+            case SH:
+            case SW:
+                r = _mm256_add_epi32(a, b);
+                break;
+            case SUB:
+                r = _mm256_sub_epi32(a, b);
+                break;
+            case JALR:
+                r = _mm256_andnot_si256(one, _mm256_add_epi32(a, b));
+                break;
+            case BEQ:
+                r = _mm256_and_si256(_mm256_cmpeq_epi32(a, b), one);
+                break;
+            case BNE:
+                r = _mm256_andnot_si256(_mm256_cmpeq_epi32(a, b), one);
+                break;
+            case BLT:
+            case SLTI:
+            case SLT:
+                r = _mm256_and_si256(_mm256_cmpgt_epi32(b, a), one);
+                break;
+            case BGE:
+                r = _mm256_andnot_si256(_mm256_cmpgt_epi32(b, a), one);
+                break;
+            case BLTU:
+            case SLTIU:
+            case SLTU:
+                r = _mm256_and_si256(_mm256_cmpgt_epi32(_mm256_xor_si256(b, sign), _mm256_xor_si256(a, sign)), one);
+                break;
+            case BGEU:
+                r = _mm256_andnot_si256(_mm256_cmpgt_epi32(_mm256_xor_si256(b, sign), _mm256_xor_si256(a, sign)), one);
+                break;
+            case XORI:
+            case XOR:
+                r = _mm256_xor_si256(a, b);
+                break;
+            case ORI:
+            case OR:
+                r = _mm256_or_si256(a, b);
+                break;
+            case ANDI:
+            case AND:
+                r = _mm256_and_si256(a, b);
+                break;
+            case SLLI:
+            case SLL:
+                r = _mm256_sllv_epi32(a, shamt);
+                break;
+            case SRLI:
+            case SRL:
+                r = _mm256_srlv_epi32(a, shamt);
+                break;
+            case SRAI:
+            case SRA:
+                r = _mm256_srav_epi32(a, shamt);
+                break;
+            case SH1ADD:
+                r = _mm256_add_epi32(_mm256_slli_epi32(a, 1), b);
+                break;
+            case SH2ADD:
+                r = _mm256_add_epi32(_mm256_slli_epi32(a, 2), b);
+                break;
+            case SH3ADD:
+                r = _mm256_add_epi32(_mm256_slli_epi32(a, 3), b);
+                break;
+            default:
+                return false;
+        }
+        _mm256_storeu_si256((__m256i *) out, r);
+        return true;
+    }
+#endif
 };
 
 
@@ -0,0 +1,306 @@
+#ifndef RISC_V_BATCH_H
+#define RISC_V_BATCH_H
+
+#include <algorithm>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <vector>
+#include "alu.h"
+#include "decode.h"
+#include "memory.h"
+#include "utils.h"
+
+// Lockstep batch interpreter: many instances of one program, differing only
+// in their initial a0..a7, run functionally in groups of kLanes. Registers
+// are kept as structure of arrays (reg_[r][lane]), and each step executes
+// one instruction for every lane sitting at the lowest PC of the group:
+// while all lanes agree that is the whole group and ALU work goes through
+// ALU::calcLanes; lanes that branch apart wait for each other at the
+// lowest PC, which brings them back together at the join after an if or
+// at the exit of a loop. A step with a single lane runs as scalar calc.
+// Loads, stores and atomics are per lane. Every lane sees the loaded image
+// and gets a private copy of a page the first time it writes to it.
+template<int memSize>
+class BatchEngine {
+    static_assert((memSize & (memSize - 1)) == 0, "memory size must be a power of two");
+
+public:
+    static const int kLanes = ALU::kLanes;
+    static const int kPageBits = 12;
+
+    u_int64_t instret_ = 0;
+    u_int64_t vectorSteps_ = 0; // steps executed for two or more lanes
+    u_int64_t scalarSteps_ = 0; // steps executed for one lane
+    u_int64_t copiedPages_ = 0;
+
+private:
+    static const u_int32_t kPageSize = 1u << kPageBits;
+    static const int kPages = memSize >> kPageBits;
+    static const u_int8_t kAllLanes = (1 << kLanes) - 1;
+
+    Memory<memSize> &mem_;
+    alignas(32) u_int32_t reg_[32][kLanes];
+    u_int32_t pc_[kLanes];
+    u_int8_t live_ = 0;              // lanes still running
+    bool reserved_[kLanes];          // LR.W reservations
+    u_int32_t reservation_[kLanes];
+    std::vector<byte *> page_;       // [lane * kPages + page]: private copy, or nullptr
+    std::vector<u_int8_t> owners_;   // per page: lanes holding a private copy
+    std::vector<std::vector<byte>> pool_;
+    size_t used_ = 0;                // pool_ entries handed out in this group
+
+public:
+    explicit BatchEngine(Memory<memSize> &mem)
+            : mem_(mem), page_((size_t) kLanes * kPages, nullptr), owners_(kPages, 0) {}
+
+    // Runs instance i from PC 0 with a0.. set to inputs[i] until it reaches
+    // the end instruction; returns the a0 & 255 of each.
+    std::vector<u_int32_t> Run(const std::vector<std::vector<u_int32_t>> &inputs) {
+        std::vector<u_int32_t> result(inputs.size());
+        for (size_t first = 0; first < inputs.size(); first += kLanes) {
+            int lanes = (int) std::min<size_t>(kLanes, inputs.size() - first);
+            Reset();
+            for (int l = 0; l < lanes; ++l) {
+                const std::vector<u_int32_t> &in = inputs[first + l];
+                for (size_t j = 0; j < in.size() && j < 8; ++j) reg_[10 + j][l] = in[j];
+                live_ |= 1 << l;
+            }
+            RunGroup();
+            for (int l = 0; l < lanes; ++l) result[first + l] = reg_[10][l] & 255u;
+        }
+        return result;
+    }
+
+    void Report(std::ostream &os, size_t instances, double seconds) const {
+        u_int64_t steps = vectorSteps_ + scalarSteps_;
+        os << std::dec << std::fixed << std::setprecision(4)
+           << "instructions " << instret_ << '\n'
+           << "batch_instances " << instances << '\n'
+           << "batch_vector_steps " << vectorSteps_ << '\n'
+           << "batch_scalar_steps " << scalarSteps_ << '\n'
+           << "batch_lanes_per_step " << (steps ? 1.0 * instret_ / steps : 0.0) << '\n'
+           << "batch_copied_pages " << copiedPages_ << '\n'
+           << "wall_seconds " << seconds << '\n'
+           << "host_mips " << (seconds > 0 ? instret_ / seconds / 1e6 : 0.0) << '\n';
+    }
+
+private:
+    void Reset() {
+        memset(reg_, 0, sizeof reg_);
+        memset(pc_, 0, sizeof pc_);
+        memset(reserved_, 0, sizeof reserved_);
+        for (int p = 0; p < kPages; ++p) {
+            if (!owners_[p]) continue;
+            for (int l = 0; l < kLanes; ++l) page_[(size_t) l * kPages + p] = nullptr;
+            owners_[p] = 0;
+        }
+        used_ = 0;
+        live_ = 0;
+    }
+
+    void RunGroup() {
+        u_int32_t pc = 0;
+        u_int8_t mask = live_;
+        while (live_) {
+            if (mask != live_) { // somebody branched apart: lowest PC first
+                pc = ~0u;
+                for (int l = 0; l < kLanes; ++l)
+                    if (live_ >> l & 1) pc = std::min(pc, pc_[l]);
+                mask = 0;
+                for (int l = 0; l < kLanes; ++l)
+                    if ((live_ >> l & 1) && pc_[l] == pc) mask |= 1 << l;
+            }
+            u_int8_t step = mask;
+            u_int32_t order = Fetch(pc, step);
+            if (order == 0x0ff00513u) {
+                live_ &= ~step;
+                mask = 0;
+                continue;
+            }
+            u_int32_t next = Step(pc, order, step);
+            if (step != mask || next == ~0u) mask = 0; // lanes apart: select again
+            else pc = next;
+        }
+    }
+
+    // The instruction at pc; narrows mask to the lanes that see the same
+    // word when some of them have written over the code.
+    u_int32_t Fetch(u_int32_t pc, u_int8_t &mask) {
+        pc &= memSize - 1;
+        if (!(owners_[pc >> kPageBits] & mask)) return mem_.readWord(pc);
+        int first = __builtin_ctz(mask);
+        u_int32_t order = Load(first, LW, pc);
+        for (int l = first + 1; l < kLanes; ++l)
+            if ((mask >> l & 1) && Load(l, LW, pc) != order) mask &= ~(1 << l);
+        return order;
+    }
+
+    // Executes order at pc for the lanes in mask; returns the PC they all
+    // continue at, or ~0u when they go different ways (pc_ has them).
+    u_int32_t Step(u_int32_t pc, u_int32_t order, u_int8_t mask) {
+        Decode decoder;
+        decoder.SetOrder(order);
+        decoder.decode();
+        ALU alu;
+        int lanes = __builtin_popcount(mask);
+        instret_ += lanes;
+        if (lanes > 1) ++vectorSteps_;
+        else ++scalarSteps_;
+        u_int8_t rd = decoder.rd_, rs1 = decoder.rs1_, rs2 = decoder.rs2_;
+        u_int32_t imm = decoder.imm_, next = pc + 4;
+        alignas(32) u_int32_t out[kLanes], operand[kLanes];
+        switch (decoder.type_) {
+            case 'U':
+                Broadcast(rd, decoder.op_ == LUI ? imm : imm + pc, mask);
+                break;
+            case 'J':
+                Broadcast(rd, pc + 4, mask);
+                next = pc + imm;
+                break;
+            case 'B': {
+                Calc(alu, decoder.op_, reg_[rs1], reg_[rs2], out, mask);
+                u_int8_t taken = 0;
+                for (int l = 0; l < kLanes; ++l)
+                    if ((mask >> l & 1) && out[l]) taken |= 1 << l;
+                if (taken == mask) next = pc + imm;
+                else if (taken) return Split(mask, taken, pc + imm, pc + 4);
+                break;
+            }
+            case 'L':
+                for (int l = 0; l < kLanes; ++l) {
+                    if (!(mask >> l & 1)) continue;
+                    u_int32_t v = Load(l, decoder.op_, reg_[rs1][l] + imm);
+                    if (rd) reg_[rd][l] = v;
+                }
+                break;
+            case 'S':
+                for (int l = 0; l < kLanes; ++l)
+                    if (mask >> l & 1) Store(l, decoder.op_, reg_[rs1][l] + imm, reg_[rs2][l]);
+                break;
+            case 'I':
+                for (int l = 0; l < kLanes; ++l) operand[l] = imm;
+                Calc(alu, decoder.op_, reg_[rs1], operand, out, mask);
+                if (decoder.op_ == JALR) {
+                    Broadcast(rd, pc + 4, mask);
+                    u_int8_t same = 0;
+                    next = out[__builtin_ctz(mask)];
+                    for (int l = 0; l < kLanes; ++l)
+                        if ((mask >> l & 1) && out[l] == next) same |= 1 << l;
+                    if (same != mask) {
+                        for (int l = 0; l < kLanes; ++l)
+                            if (mask >> l & 1) pc_[l] = out[l];
+                        return ~0u;
+                    }
+                } else Merge(rd, out, mask);
+                break;
+            case 'R':
+                Calc(alu, decoder.op_, reg_[rs1], reg_[rs2], out, mask);
+                Merge(rd, out, mask);
+                break;
+            case 'A':
+                for (int l = 0; l < kLanes; ++l)
+                    if (mask >> l & 1) Atomic(alu, l, decoder.op_, rd, reg_[rs1][l], reg_[rs2][l]);
+                break;
+            default: // unknown encodings retire as nops
+                break;
+        }
+        for (int l = 0; l < kLanes; ++l)
+            if (mask >> l & 1) pc_[l] = next;
+        return next;
+    }
+
+    void Calc(ALU &alu, RV32I_Order op, const u_int32_t *r1, const u_int32_t *r2, u_int32_t *out, u_int8_t mask) {
+        if (mask & (mask - 1)) return alu.calcLanes(op, r1, r2, out);
+        int l = __builtin_ctz(mask);
+        out[l] = alu.calc(op, r1[l], r2[l]);
+    }
+
+    u_int32_t Split(u_int8_t mask, u_int8_t taken, u_int32_t target, u_int32_t fallThrough) {
+        for (int l = 0; l < kLanes; ++l)
+            if (mask >> l & 1) pc_[l] = taken >> l & 1 ? target : fallThrough;
+        return ~0u;
+    }
+
+    void Merge(u_int8_t rd, const u_int32_t *out, u_int8_t mask) {
+        if (!rd) return;
+        if (mask == kAllLanes) {
+            memcpy(reg_[rd], out, sizeof reg_[rd]);
+            return;
+        }
+        for (int l = 0; l < kLanes; ++l)
+            if (mask >> l & 1) reg_[rd][l] = out[l];
+    }
+
+    void Broadcast(u_int8_t rd, u_int32_t val, u_int8_t mask) {
+        if (!rd) return;
+        for (int l = 0; l < kLanes; ++l)
+            if (mask >> l & 1) reg_[rd][l] = val;
+    }
+
+    void Atomic(ALU &alu, int l, RV32I_Order op, u_int8_t rd, u_int32_t addr, u_int32_t src) {
+        u_int32_t old = Load(l, LW, addr), val = old;
+        if (op == LR_W) {
+            reserved_[l] = true, reservation_[l] = addr;
+        } else if (op == SC_W) {
+            bool ok = reserved_[l] && reservation_[l] == addr;
+            if (ok) Store(l, SW, addr, src);
+            reserved_[l] = false;
+            val = !ok;
+        } else if (op != NOPE) {
+            Store(l, SW, addr, alu.calc(op, old, src));
+        } else return;
+        if (rd) reg_[rd][l] = val;
+    }
+
+    // ---- per-lane memory ----
+
+    byte *Page(int l, u_int32_t addr) {
+        byte *p = page_[(size_t) l * kPages + (addr >> kPageBits)];
+        return p ? p : mem_.data() + (addr & ~(kPageSize - 1));
+    }
+
+    byte ReadByte(int l, u_int32_t addr) {
+        addr &= memSize - 1;
+        return Page(l, addr)[addr & (kPageSize - 1)];
+    }
+
+    void WriteByte(int l, u_int32_t addr, byte b) {
+        addr &= memSize - 1;
+        Own(l, addr)[addr & (kPageSize - 1)] = b;
+    }
+
+    u_int32_t Load(int l, RV32I_Order op, u_int32_t addr) {
+        int width = op == LB || op == LBU ? 1 : op == LH || op == LHU ? 2 : 4;
+        u_int32_t v = 0;
+        addr &= memSize - 1;
+        if ((addr & (kPageSize - 1)) <= kPageSize - width) {
+            const byte *p = Page(l, addr) + (addr & (kPageSize - 1));
+            for (int i = width - 1; i >= 0; --i) v = v << 8 | p[i];
+        } else {
+            for (int i = width - 1; i >= 0; --i) v = v << 8 | ReadByte(l, addr + i);
+        }
+        if (op == LB) return (u_int32_t) (int8_t) v;
+        if (op == LH) return (u_int32_t) (int16_t) v;
+        return v;
+    }
+
+    void Store(int l, RV32I_Order op, u_int32_t addr, u_int32_t v) {
+        int width = op == SB ? 1 : op == SH ? 2 : 4;
+        for (int i = 0; i < width; ++i) WriteByte(l, addr + i, v >> (8 * i) & 255);
+    }
+
+    // Lane l's own copy of the page holding addr.
+    byte *Own(int l, u_int32_t addr) {
+        byte *&p = page_[(size_t) l * kPages + (addr >> kPageBits)];
+        if (p) return p;
+        if (used_ == pool_.size()) pool_.emplace_back((size_t) kPageSize);
+        p = pool_[used_++].data();
+        memcpy(p, mem_.data() + (addr & ~(kPageSize - 1)), kPageSize);
+        owners_[addr >> kPageBits] |= 1 << l;
+        ++copiedPages_;
+        return p;
+    }
+};
+
+#endif //RISC_V_BATCH_H
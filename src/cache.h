@@ -0,0 +1,239 @@
+#ifndef RISC_V_CACHE_H
+#define RISC_V_CACHE_H
+
+#include <algorithm>
+#include "stats.h"
+#include "utils.h"
+
+enum PrefetchKind {
+    kPrefetchStride = 1, // per load PC: a repeated address delta
+    kPrefetchStream = 2, // consecutive lines missed in ascending order
+    kPrefetchAll = 3
+};
+
+// Memory timing of the load path (--miss-latency and --prefetch*), shared
+// by all cores. A miss latency of 0 leaves every load at the flat 3 cycles.
+struct CacheConfig {
+    int missLatency = 0; // extra cycles of a load that misses the cache
+    int prefetch = kPrefetchAll;
+    int degree = 2;      // lines requested ahead per trigger
+    int outstanding = 4; // prefetches in flight at once
+} cacheConfig;
+
+// Data cache timing model: 16 KiB, 4-way, 64-byte lines, LRU. It holds
+// tags only (values always come from memory) and exists to give loads a
+// hit or miss latency and the prefetchers somewhere to put lines. Loads
+// go to memory one at a time, so a demand miss simply takes missLatency
+// cycles; prefetches wait in a queue for one of `outstanding` slots and
+// fill missLatency cycles after they start. Fills are applied lazily on
+// the next access, which keeps skipped idle cycles exact. Stores allocate
+// without a penalty; other harts' writes are left to the coherence model.
+class DataCache {
+public:
+    static const int kLineBits = 6;
+    static const int kSets = 64;
+    static const int kWays = 4;
+    static const int kStrideEntries = 64;
+    static const int kStreams = 4;
+    static const int kMaxOutstanding = 16;
+    static const int kQueue = 32;
+
+private:
+    struct Way {
+        u_int32_t line = 0;
+        u_int32_t used = 0;      // LRU stamp
+        bool valid = false;
+        bool prefetched = false; // filled by a prefetch, no demand hit yet
+    };
+
+    struct Stride {
+        u_int32_t pc = 0;
+        u_int32_t last = 0;
+        int32_t stride = 0;
+        int confidence = 0;
+    };
+
+    struct Fill {
+        u_int32_t line = 0;
+        int ready = 0; // cycle the line arrives
+        bool busy = false;
+    };
+
+    struct Request {
+        u_int32_t line = 0;
+        int time = 0; // cycle it was asked for
+    };
+
+    Way way_[kSets][kWays];
+    Stride stride_[kStrideEntries];
+    u_int32_t stream_[kStreams]; // next line each stream expects to miss
+    Fill fill_[kMaxOutstanding];
+    Request queue_[kQueue];
+    int head_ = 0, size_ = 0;    // queue_
+    int inflight_ = 0;
+    int nextStream_ = 0;
+    u_int32_t stamp_ = 0;
+
+public:
+    constexpr DataCache() : way_(), stride_(), stream_(), fill_(), queue_() {}
+
+    void Reset() {
+        for (auto &set: way_) for (auto &w: set) w = Way();
+        for (auto &s: stride_) s = Stride();
+        for (auto &s: stream_) s = 0;
+        for (auto &f: fill_) f = Fill();
+        head_ = size_ = inflight_ = nextStream_ = 0;
+    }
+
+    // A load from addr by the instruction at pc goes to memory at cycle
+    // now; returns its cycles beyond a hit.
+    int Load(u_int32_t pc, u_int32_t addr, int now) {
+        Advance(now);
+        u_int32_t line = addr >> kLineBits;
+        int extra = 0;
+        bool trigger = true; // a miss, or the first use of a prefetched line
+        ++stats.dcacheAccesses;
+        if (Way *w = Find(line)) {
+            trigger = w->prefetched;
+            if (w->prefetched) ++stats.prefetchUseful, w->prefetched = false;
+            w->used = ++stamp_;
+        } else if (Fill *f = InFlight(line)) {
+            ++stats.prefetchLate;
+            extra = f->ready - now;
+            f->busy = false;
+            --inflight_;
+            Install(line, false);
+        } else {
+            ++stats.dcacheMisses;
+            extra = cacheConfig.missLatency;
+            Install(line, false);
+        }
+        if (cacheConfig.prefetch & kPrefetchStride) TrainStride(pc, addr, now);
+        if (cacheConfig.prefetch & kPrefetchStream && trigger) TrainStream(line, now);
+        return extra;
+    }
+
+    void Store(u_int32_t addr, int now) {
+        Advance(now);
+        u_int32_t line = addr >> kLineBits;
+        if (Way *w = Find(line)) w->used = ++stamp_;
+        else if (!InFlight(line)) Install(line, false);
+    }
+
+private:
+    Way *Find(u_int32_t line) {
+        for (auto &w: way_[line % kSets]) if (w.valid && w.line == line) return &w;
+        return nullptr;
+    }
+
+    Fill *InFlight(u_int32_t line) {
+        for (int i = 0; i < cacheConfig.outstanding; ++i)
+            if (fill_[i].busy && fill_[i].line == line) return &fill_[i];
+        return nullptr;
+    }
+
+    void Install(u_int32_t line, bool prefetched) {
+        Way *victim = way_[line % kSets];
+        for (auto &w: way_[line % kSets]) {
+            if (!w.valid) {
+                victim = &w;
+                break;
+            }
+            if (w.used < victim->used) victim = &w;
+        }
+        if (victim->valid && victim->prefetched) ++stats.prefetchUnused;
+        *victim = Way();
+        victim->line = line;
+        victim->used = ++stamp_;
+        victim->valid = true;
+        victim->prefetched = prefetched;
+    }
+
+    // Asks for line at cycle now unless it is already here or on its way.
+    void Prefetch(u_int32_t line, int now) {
+        if (Find(line) || InFlight(line)) return;
+        for (int k = 0; k < size_; ++k) if (queue_[(head_ + k) % kQueue].line == line) return;
+        if (size_ == kQueue) return; // dropped: the oldest requests are the most useful
+        queue_[(head_ + size_++) % kQueue] = (Request) {line, now};
+        Advance(now);
+    }
+
+    // Starts the oldest queued request at cycle `start`; false if it was
+    // no longer needed.
+    bool Start(int start) {
+        Request r = queue_[head_];
+        head_ = (head_ + 1) % kQueue, --size_;
+        if (Find(r.line) || InFlight(r.line)) return false;
+        for (int i = 0; i < cacheConfig.outstanding; ++i) {
+            if (fill_[i].busy) continue;
+            fill_[i] = (Fill) {r.line, start + cacheConfig.missLatency, true};
+            ++inflight_;
+            ++stats.prefetchIssued;
+            ++stats.activity[kEnMemRead];
+            break;
+        }
+        return true;
+    }
+
+    // Brings the fills and the queue up to cycle now, in cycle order.
+    void Advance(int now) {
+        for (;;) {
+            while (size_ && inflight_ < cacheConfig.outstanding && queue_[head_].time <= now)
+                Start(queue_[head_].time);
+            int first = -1;
+            for (int i = 0; i < cacheConfig.outstanding; ++i)
+                if (fill_[i].busy && fill_[i].ready <= now && (first < 0 || fill_[i].ready < fill_[first].ready))
+                    first = i;
+            if (first < 0) return;
+            fill_[first].busy = false;
+            --inflight_;
+            Install(fill_[first].line, true);
+            while (size_ && queue_[head_].time <= now) // it was waiting for this slot
+                if (Start(std::max(queue_[head_].time, fill_[first].ready))) break;
+        }
+    }
+
+    void TrainStride(u_int32_t pc, u_int32_t addr, int now) {
+        Stride &s = stride_[(pc >> 2) % kStrideEntries];
+        if (s.pc != pc) {
+            s = Stride();
+            s.pc = pc;
+            s.last = addr;
+            return;
+        }
+        int32_t delta = (int32_t) (addr - s.last);
+        s.last = addr;
+        if (delta && delta == s.stride) {
+            if (s.confidence < 3) ++s.confidence;
+        } else {
+            s.stride = delta;
+            s.confidence = 0;
+            return;
+        }
+        if (s.confidence < 2) return;
+        u_int32_t line = addr >> kLineBits;
+        for (int k = 1, issued = 0; issued < cacheConfig.degree && k <= 64; ++k) {
+            u_int32_t next = (addr + (u_int32_t) s.stride * k) >> kLineBits;
+            if (next == line) continue; // several strides to a line
+            line = next;
+            Prefetch(line, now);
+            ++issued;
+        }
+    }
+
+    void TrainStream(u_int32_t line, int now) {
+        int s = 0;
+        while (s < kStreams && stream_[s] != line) ++s;
+        if (s == kStreams) { // not the continuation of a stream: start one
+            stream_[nextStream_] = line + 1;
+            nextStream_ = (nextStream_ + 1) % kStreams;
+            return;
+        }
+        stream_[s] = line + 1;
+        for (int k = 1; k <= cacheConfig.degree; ++k) Prefetch(line + k, now);
+    }
+};
+
+thread_local DataCache dcache; // this thread's core
+
+#endif //RISC_V_CACHE_H
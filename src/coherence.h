@@ -0,0 +1,180 @@
+#ifndef RISC_V_COHERENCE_H
+#define RISC_V_COHERENCE_H
+
+#include <atomic>
+#include <iostream>
+#include <mutex>
+#include <vector>
+#include "alu.h"
+#include "memory.h"
+#include "utils.h"
+
+// Per-hart coherence counters.
+struct CoherenceStats {
+    u_int64_t hits = 0;
+    u_int64_t misses = 0;        // line not held by this hart
+    u_int64_t upgrades = 0;      // store to a line held Shared
+    u_int64_t invalidations = 0; // copies in other harts invalidated by this hart
+    u_int64_t interventions = 0; // line supplied by another hart's Modified copy
+    u_int64_t scFailures = 0;
+};
+
+// Memory shared by every core. Data accesses go through here so that, with
+// more than one hart, a MESI directory over 64-byte lines can be kept: each
+// line is Modified/Exclusive in one owner, Shared by a set of harts, or
+// Invalid. Lines are guarded by striped locks, which makes every access and
+// every atomic a single step for harts running on other host threads.
+// With one hart there is no directory and no locking on plain accesses.
+template<int memSize>
+class CoherentMemory {
+public:
+    static const int kMaxHarts = 8;
+    static const int kLineBits = 6;
+    static const int kStripes = 256;
+    static const int kInterventionPenalty = 6; // extra load cycles when another hart holds the line Modified
+
+private:
+    struct Line {
+        u_int8_t sharers = 0; // S copies, one bit per hart
+        int8_t owner = -1;    // hart holding the line E (clean) or M (dirty)
+        bool dirty = false;
+    };
+
+    static const u_int32_t kNoReservation = ~0u;
+
+    Memory<memSize> &mem_;
+    int harts_ = 1;
+    std::vector<Line> lines_;
+    std::mutex locks_[kStripes];
+    std::atomic<u_int32_t> reservation_[kMaxHarts]; // line index of each hart's LR.W
+
+public:
+    CoherenceStats stats_[kMaxHarts];
+
+    explicit CoherentMemory(Memory<memSize> &mem) : mem_(mem) {
+        for (auto &r: reservation_) r = kNoReservation;
+    }
+
+    void SetHarts(int harts) {
+        harts_ = harts;
+        if (harts_ > 1) lines_.assign(memSize >> kLineBits, Line());
+    }
+
+    int Harts() const { return harts_; }
+
+    // Loads for hart h; latency receives the extra cycles of the access.
+    u_int32_t Load(int h, RV32I_Order op, addr_t addr, int &latency) {
+        if (harts_ == 1) return Read(op, addr);
+        std::lock_guard<std::mutex> guard(Lock(addr));
+        latency += Share(h, addr >> kLineBits);
+        return Read(op, addr);
+    }
+
+    void Store(int h, RV32I_Order op, addr_t addr, u_int32_t data) {
+        if (harts_ == 1) return Write(op, addr, data);
+        std::lock_guard<std::mutex> guard(Lock(addr));
+        Own(h, addr >> kLineBits);
+        Write(op, addr, data);
+    }
+
+    // LR.W/SC.W/AMO*.W of hart h; returns the value for rd.
+    u_int32_t Atomic(int h, RV32I_Order op, addr_t addr, u_int32_t src) {
+        std::lock_guard<std::mutex> guard(Lock(addr));
+        u_int32_t line = addr >> kLineBits, old = mem_.readWord(addr);
+        if (op == NOPE) return 0;
+        if (op == LR_W) {
+            if (harts_ > 1) Share(h, line);
+            reservation_[h] = line;
+            return old;
+        }
+        if (op == SC_W && reservation_[h].exchange(kNoReservation) != line) {
+            ++stats_[h].scFailures;
+            return 1;
+        }
+        if (harts_ > 1) Own(h, line);
+        ALU alu;
+        mem_.writeWord(addr, alu.calc(op, old, src));
+        return op == SC_W ? 0 : old;
+    }
+
+    void Report(std::ostream &os) const {
+        CoherenceStats sum;
+        for (int h = 0; h < harts_; ++h) {
+            sum.hits += stats_[h].hits;
+            sum.misses += stats_[h].misses;
+            sum.upgrades += stats_[h].upgrades;
+            sum.invalidations += stats_[h].invalidations;
+            sum.interventions += stats_[h].interventions;
+            sum.scFailures += stats_[h].scFailures;
+        }
+        os << "coherence_hits " << sum.hits << '\n'
+           << "coherence_misses " << sum.misses << '\n'
+           << "coherence_upgrades " << sum.upgrades << '\n'
+           << "coherence_invalidations " << sum.invalidations << '\n'
+           << "coherence_interventions " << sum.interventions << '\n'
+           << "sc_failures " << sum.scFailures << '\n';
+    }
+
+private:
+    std::mutex &Lock(addr_t addr) { return locks_[(addr >> kLineBits) % kStripes]; }
+
+    u_int32_t Read(RV32I_Order op, addr_t addr) {
+        if (op == LB) return (u_int32_t) (int8_t) mem_.readByte(addr);
+        if (op == LH) return (u_int32_t) (int16_t) mem_.readHfWord(addr);
+        if (op == LBU) return mem_.readByte(addr);
+        if (op == LHU) return mem_.readHfWord(addr);
+        return mem_.readWord(addr);
+    }
+
+    void Write(RV32I_Order op, addr_t addr, u_int32_t data) {
+        if (op == SB) mem_.writeByte(addr, data & 0xff);
+        else if (op == SH) mem_.writeHfWord(addr, data & 0xffff);
+        else mem_.writeWord(addr, data);
+    }
+
+    // Read request: afterwards hart h holds the line E (alone) or S.
+    int Share(int h, u_int32_t line) {
+        Line &l = lines_[line];
+        if (l.owner == h || (l.sharers >> h & 1)) {
+            ++stats_[h].hits;
+            return 0;
+        }
+        ++stats_[h].misses;
+        int latency = 0;
+        if (l.owner >= 0) { // the E/M copy drops to S
+            if (l.dirty) ++stats_[h].interventions, latency = kInterventionPenalty;
+            l.sharers |= 1 << l.owner;
+            l.owner = -1;
+            l.dirty = false;
+        }
+        if (l.sharers) l.sharers |= 1 << h;
+        else l.owner = h;
+        return latency;
+    }
+
+    // Write request: afterwards hart h holds the line M and nobody else has
+    // a copy or a reservation on it.
+    void Own(int h, u_int32_t line) {
+        Line &l = lines_[line];
+        if (l.owner == h) {
+            ++stats_[h].hits;
+        } else {
+            if (l.sharers >> h & 1) ++stats_[h].upgrades;
+            else ++stats_[h].misses;
+            if (l.owner >= 0) {
+                if (l.dirty) ++stats_[h].interventions;
+                ++stats_[h].invalidations;
+            }
+            for (u_int8_t others = l.sharers & ~(1 << h); others; others &= others - 1) ++stats_[h].invalidations;
+            l.sharers = 0;
+            l.owner = h;
+        }
+        l.dirty = true;
+        for (int other = 0; other < harts_; ++other) {
+            u_int32_t expected = line;
+            if (other != h) reservation_[other].compare_exchange_strong(expected, kNoReservation);
+        }
+    }
+};
+
+#endif //RISC_V_COHERENCE_H
@@ -0,0 +1,115 @@
+#ifndef RISC_V_COSIM_H
+#define RISC_V_COSIM_H
+
+#include <cstdlib>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include "alu.h"
+#include "decode.h"
+#include "functional.h"
+#include "memory.h"
+
+// Lockstep commit-level checker: a FunctionalCore on a private copy of the
+// program image is stepped once per instruction the Tomasulo core retires,
+// and PC, destination value and store address/data are compared. The first
+// disagreement ends the run with a diagnostic.
+template<int memSize>
+class CoSimChecker {
+    Memory<memSize> *mem_ = nullptr;
+    FunctionalCore<memSize> *ref_ = nullptr;
+
+    static const int kMaxDropped = 1 << 20; // x0-writes the front end may skip in a row
+
+public:
+    bool enabled_ = false;
+    u_int64_t checked_ = 0;
+
+    ~CoSimChecker() {
+        delete ref_;
+        delete mem_;
+    }
+
+    // Must be called once the program is loaded, before the core runs.
+    void Enable(Memory<memSize> &image) {
+        mem_ = new Memory<memSize>(image);
+        ref_ = new FunctionalCore<memSize>(*mem_);
+        enabled_ = true;
+    }
+
+    // One ROB entry retires. val is the destination value (store data for
+    // stores, the taken flag for branches) and addr the store address.
+    void Retire(int clock, u_int32_t pc, u_int32_t order, u_int32_t val, u_int32_t addr = 0) {
+        GuestContext &ctx = ref_->ctx_;
+        Reach(clock, pc, order);
+        Decode decoder;
+        decoder.SetOrder(order);
+        decoder.decode();
+        u_int32_t r1 = ctx.reg[decoder.rs1_], r2 = ctx.reg[decoder.rs2_];
+        if (order == 0x0ff00513u) { // the end marker is not executed, only its PC matters
+            ++checked_;
+            return;
+        }
+        u_int32_t stored = ref_->Step();
+        ++checked_;
+        if (decoder.type_ == 'S') {
+            u_int32_t mask = decoder.op_ == SB ? 0xffu : decoder.op_ == SH ? 0xffffu : 0xffffffffu;
+            if (stored != addr) Fail(clock, pc, order, "store address", stored, addr);
+            if ((r2 & mask) != (val & mask)) Fail(clock, pc, order, "store data", r2 & mask, val & mask);
+        } else if (decoder.type_ == 'B') {
+            ALU alu;
+            u_int32_t taken = alu.calc(decoder.op_, r1, r2);
+            if (taken != val) Fail(clock, pc, order, "branch outcome", taken, val);
+        } else if (decoder.rd_ && ctx.reg[decoder.rd_] != val) {
+            Fail(clock, pc, order, "x" + std::to_string(decoder.rd_), ctx.reg[decoder.rd_], val);
+        }
+    }
+
+    // The first instruction of a fused pair retires. Its result only exists
+    // combined with the second one's, so just its PC and word are checked.
+    void RetireFused(int clock, u_int32_t pc, u_int32_t order) {
+        Reach(clock, pc, order);
+        ref_->Step();
+        ++checked_;
+    }
+
+private:
+    // Steps the reference over dropped instructions up to the one at pc.
+    void Reach(int clock, u_int32_t pc, u_int32_t order) {
+        GuestContext &ctx = ref_->ctx_;
+        for (int n = 0; !Retires(ctx.pc); ++n) {
+            if (n == kMaxDropped) Fail(clock, pc, order, "pc (reference never reaches a retiring instruction)", pc, ctx.pc);
+            ref_->Step();
+        }
+        if (ctx.pc != pc) Fail(clock, pc, order, "pc", ctx.pc, pc);
+        if (mem_->readWord(pc) != order) Fail(clock, pc, order, "instruction word", mem_->readWord(pc), order);
+    }
+
+    // Mirrors Simulator::Fetch: only stores, atomics, branches, JALR and instructions
+    // writing a non-zero register ever reach the ROB.
+    bool Retires(u_int32_t pc) {
+        Decode decoder;
+        u_int32_t order = mem_->readWord(pc);
+        decoder.SetOrder(order);
+        decoder.decode();
+        return decoder.type_ == 'S' || decoder.type_ == 'A' || decoder.type_ == 'B' || decoder.op_ == JALR ||
+               decoder.rd_ != 0;
+    }
+
+    void Fail(int clock, u_int32_t pc, u_int32_t order, const std::string &what,
+              u_int32_t expected, u_int32_t got) {
+        Decode decoder;
+        decoder.SetOrder(order);
+        decoder.decode();
+        std::cout.flush();
+        std::cerr << "cosim: mismatch at cycle " << std::dec << clock << " after " << checked_
+                  << " retired instructions\n" << std::hex << std::setfill('0')
+                  << "  pc 0x" << std::setw(8) << pc << "  order 0x" << std::setw(8) << order
+                  << "  " << kOrderName[decoder.op_] << '\n'
+                  << "  " << what << ": reference 0x" << std::setw(8) << expected
+                  << ", core 0x" << std::setw(8) << got << '\n';
+        exit(3);
+    }
+};
+
+#endif //RISC_V_COSIM_H
@@ -4,16 +4,119 @@
 #include <iostream>
 #include "utils.h"
 
+// How the immediate is pulled out of an instruction word.
+enum ImmKind : u_int8_t {
+    IMM_NONE, IMM_I, IMM_IJ, IMM_IU, IMM_U, IMM_J, IMM_B, IMM_S
+};
+
+// Which register/funct fields an encoding carries.
+enum DecodeField : u_int8_t {
+    F_RD = 1, F_RS1 = 2, F_RS2 = 4, F_FUNCT3 = 8, F_FUNCT7 = 16
+};
+
+struct DecodeEntry {
+    RV32I_Order op = NOPE;
+    char type = 0;
+    u_int8_t imm = IMM_NONE;
+    u_int8_t fields = 0;
+};
+
+// Indexed by opcode[6:0] | funct3 << 7 | order[30] << 10, so every encoding
+// is classified with a single read; RV32A operations take a second one by
+// funct5.
+struct DecodeTable {
+    static const int kSize = 1 << 11;
+    DecodeEntry entry[kSize];
+    RV32I_Order atomic[32] = {};
+};
+
+constexpr DecodeEntry MakeEntry(RV32I_Order op, char type, u_int8_t imm, u_int8_t fields) {
+    DecodeEntry e;
+    e.op = op;
+    e.type = type;
+    e.imm = imm;
+    e.fields = fields;
+    return e;
+}
+
+constexpr DecodeEntry Classify(u_int32_t opcode, u_int32_t funct3, bool alt) {
+    switch (opcode) {
+        case 0x37:
+            return MakeEntry(LUI, 'U', IMM_U, F_RD);
+        case 0x17:
+            return MakeEntry(AUIPC, 'U', IMM_U, F_RD);
+        case 0x6f:
+            return MakeEntry(JAL, 'J', IMM_J, F_RD);
+        case 0x67:
+            return MakeEntry(JALR, 'I', IMM_IJ, F_RD | F_RS1);
+        case 0x63: {
+            const RV32I_Order ops[] = {BEQ, BNE, NOPE, NOPE, BLT, BGE, BLTU, BGEU};
+            return MakeEntry(ops[funct3], 'B', IMM_B, F_RS1 | F_RS2 | F_FUNCT3);
+        }
+        case 0x03: {
+            const RV32I_Order ops[] = {LB, LH, LW, NOPE, LBU, LHU, NOPE, NOPE};
+            return MakeEntry(ops[funct3], 'L', IMM_I, F_RD | F_RS1 | F_FUNCT3);
+        }
+        case 0x23: {
+            const RV32I_Order ops[] = {SB, SH, SW, NOPE, NOPE, NOPE, NOPE, NOPE};
+            return MakeEntry(ops[funct3], 'S', IMM_S, F_RS1 | F_RS2 | F_FUNCT3);
+        }
+        case 0x13: {
+            const RV32I_Order ops[] = {ADDI, SLLI, SLTI, SLTIU, XORI, alt ? SRAI : SRLI, ORI, ANDI};
+            u_int8_t imm = (funct3 == 1 || funct3 == 5) ? IMM_IU : IMM_I;
+            return MakeEntry(ops[funct3], 'I', imm, F_RD | F_RS1 | F_FUNCT3);
+        }
+        case 0x2f: // RV32A; the operation comes from funct5, see AtomicOp
+            if (funct3 != 2) return DecodeEntry();
+            return MakeEntry(NOPE, 'A', IMM_NONE, F_RD | F_RS1 | F_RS2 | F_FUNCT3 | F_FUNCT7);
+        case 0x33: {
+            const RV32I_Order ops[] = {alt ? SUB : ADD, SLL, SLT, SLTU, XOR, alt ? SRA : SRL, OR, AND};
+            return MakeEntry(ops[funct3], 'R', IMM_NONE, F_RD | F_RS1 | F_RS2 | F_FUNCT3 | F_FUNCT7);
+        }
+        default:
+            return DecodeEntry();
+    }
+}
+
+// funct5 (order[31:27]) of an RV32A instruction.
+constexpr RV32I_Order AtomicOp(u_int32_t funct5) {
+    switch (funct5) {
+        case 0x00: return AMOADD_W;
+        case 0x01: return AMOSWAP_W;
+        case 0x02: return LR_W;
+        case 0x03: return SC_W;
+        case 0x04: return AMOXOR_W;
+        case 0x08: return AMOOR_W;
+        case 0x0c: return AMOAND_W;
+        case 0x10: return AMOMIN_W;
+        case 0x14: return AMOMAX_W;
+        case 0x18: return AMOMINU_W;
+        case 0x1c: return AMOMAXU_W;
+        default: return NOPE;
+    }
+}
+
+constexpr DecodeTable BuildDecodeTable() {
+    DecodeTable table;
+    for (int i = 0; i < DecodeTable::kSize; ++i)
+        table.entry[i] = Classify(i & 0x7f, (i >> 7) & 7, (i >> 10) & 1);
+    for (int i = 0; i < 32; ++i)
+        table.atomic[i] = AtomicOp(i);
+    return table;
+}
+
+constexpr DecodeTable kDecodeTable = BuildDecodeTable();
+
 class Decode {
 public:
-    char type_;
-    u_int32_t order_;
-    RV32I_Order op_;
-    u_int32_t imm_;
-    u_int8_t rd_, rs1_, rs2_;
-    u_int8_t funct3_, funct7_;
+    char type_ = 0;
+    u_int32_t order_ = 0;
+    RV32I_Order op_ = NOPE;
+    u_int32_t imm_ = 0;
+    u_int8_t rd_ = 0, rs1_ = 0, rs2_ = 0;
+    u_int8_t funct3_ = 0, funct7_ = 0;
 public:
-    Decode() {}
+    constexpr Decode() {}
 
     Decode(u_int32_t &order) : order_(order) {}
 
@@ -21,240 +124,50 @@ public:
         order_ = order;
     }
 
-private:
-    u_int32_t substr(u_int32_t str, int l, int r) {
-        if (r < 31) str = str & ((1 << (r + 1)) - 1);
-        return str >> l;
-    }
-
-public:
     u_int32_t sext(u_int32_t data, int len = 32) {
         if (len == 32) return data;
         u_int32_t ext = (data >> (len - 1)) & 1 ? (0xffffffff >> len << len) : 0;
         return data | ext;
     }
 
-private:
-    u_int8_t get_opcode() { return substr(order_, 0, 6); }
-
-    u_int8_t get_rd() { return substr(order_, 7, 11); }
-
-    u_int8_t get_rs1() { return substr(order_, 15, 19); }
-
-    u_int8_t get_rs2() { return substr(order_, 20, 24); }
-
-    u_int8_t get_funct3() { return substr(order_, 12, 14); }
-
-    u_int8_t get_funct7() { return substr(order_, 25, 31); }
-
-    u_int32_t get_imm_I() { return sext(substr(order_, 20, 31), 12); }
-
-    u_int32_t get_imm_Ij() { return sext(substr(order_, 20, 31) << 1, 13); }
-
-    u_int32_t get_imm_Iu() { return substr(order_, 20, 31); }
-
-    u_int32_t get_imm_U() { return sext(substr(order_, 12, 31) << 12); }
-
-    u_int32_t get_imm_J() {
-        u_int32_t imm = 0;
-        imm |= substr(order_, 21, 30) << 1;
-        imm |= substr(order_, 20, 20) << 11;
-        imm |= substr(order_, 12, 19) << 12;
-        imm |= substr(order_, 31, 31) << 20;
-        return sext(imm, 21);
+    // All formats are extracted and the table's kind picks one, so the
+    // immediate costs no data-dependent branch.
+    static u_int32_t Immediate(u_int32_t order, u_int8_t kind) {
+        int32_t s = static_cast<int32_t>(order);
+        const u_int32_t imm[] = {
+                0,
+                static_cast<u_int32_t>(s >> 20),                                   // I
+                static_cast<u_int32_t>(s >> 20) << 1,                              // I (jalr)
+                order >> 20,                                                       // I (shamt)
+                order & 0xfffff000u,                                               // U
+                (static_cast<u_int32_t>(s >> 11) & 0xfff00000u) | (order & 0x000ff000u) |
+                (order >> 9 & 0x800u) | (order >> 20 & 0x7feu),                    // J
+                (static_cast<u_int32_t>(s >> 19) & 0xfffff000u) | (order << 4 & 0x800u) |
+                (order >> 20 & 0x7e0u) | (order >> 7 & 0x1eu),                     // B
+                (static_cast<u_int32_t>(s >> 20) & 0xffffffe0u) | (order >> 7 & 0x1fu), // S
+        };
+        return imm[kind];
     }
 
-    u_int32_t get_imm_B() {
-        u_int32_t imm = 0;
-        imm |= substr(order_, 8, 11) << 1;
-        imm |= substr(order_, 25, 30) << 5;
-        imm |= substr(order_, 7, 7) << 11;
-        imm |= substr(order_, 31, 31) << 12;
-        return sext(imm, 13);
+    // The table row of an instruction word.
+    static const DecodeEntry &Entry(u_int32_t order) {
+        return kDecodeTable.entry[(order & 0x7f) | (order >> 5 & 0x380) | (order >> 20 & 0x400)];
     }
 
-    u_int32_t get_imm_S() {
-        u_int32_t imm = 0;
-        imm |= substr(order_, 7, 11);
-        imm |= substr(order_, 25, 31) << 5;
-        return sext(imm, 12);
+    static u_int32_t Mask(u_int8_t fields, u_int8_t field) { // all ones if the field is present
+        return 0u - ((fields & field) != 0);
     }
 
-public:
     void decode() {
-        u_int8_t opt;
-        opt = get_opcode();
-        switch (opt) {
-            case 0x37:
-                type_ = 'U';
-                op_ = LUI;
-                rd_ = get_rd();
-                imm_ = get_imm_U();
-                break;
-            case 0x17:
-                type_ = 'U';
-                op_ = AUIPC;
-                rd_ = get_rd();
-                imm_ = get_imm_U();
-                break;
-            case 0x6f:
-                type_ = 'J';
-                op_ = JAL;
-                rd_ = get_rd();
-                imm_ = get_imm_J();
-                break;
-            case 0x67:
-                type_ = 'I';
-                op_ = JALR;
-                rd_ = get_rd();
-                rs1_ = get_rs1();
-                imm_ = get_imm_Ij();
-                break;
-            case 0x63:
-                type_ = 'B';
-                funct3_ = get_funct3();
-                rs1_ = get_rs1();
-                rs2_ = get_rs2();
-                imm_ = get_imm_B();
-                switch (funct3_) {
-                    case 0:
-                        op_ = BEQ;
-                        break;
-                    case 1:
-                        op_ = BNE;
-                        break;
-                    case 4:
-                        op_ = BLT;
-                        break;
-                    case 5:
-                        op_ = BGE;
-                        break;
-                    case 6:
-                        op_ = BLTU;
-                        break;
-                    case 7:
-                        op_ = BGEU;
-                        break;
-                }
-                break;
-            case 0x03:
-                type_ = 'L';
-                funct3_ = get_funct3();
-                rd_ = get_rd();
-                rs1_ = get_rs1();
-                imm_ = get_imm_I();
-                switch (funct3_) {
-                    case 0:
-                        op_ = LB;
-                        break;
-                    case 1:
-                        op_ = LH;
-                        break;
-                    case 2:
-                        op_ = LW;
-                        break;
-                    case 4:
-                        op_ = LBU;
-                        break;
-                    case 5:
-                        op_ = LHU;
-                        break;
-                }
-                break;
-            case 0x23:
-                type_ = 'S';
-                funct3_ = get_funct3();
-                rs1_ = get_rs1();
-                rs2_ = get_rs2();
-                imm_ = get_imm_S();
-                switch (funct3_) {
-                    case 0:
-                        op_ = SB;
-                        break;
-                    case 1:
-                        op_ = SH;
-                        break;
-                    case 2:
-                        op_ = SW;
-                        break;
-                }
-                break;
-            case 0x13:
-                type_ = 'I';
-                funct3_ = get_funct3();
-                rd_ = get_rd();
-                rs1_ = get_rs1();
-                switch (funct3_) {
-                    case 0:
-                        op_ = ADDI;
-                        imm_ = get_imm_I();
-                        break;
-                    case 2:
-                        op_ = SLTI;
-                        imm_ = get_imm_I();
-                        break;
-                    case 3:
-                        op_ = SLTIU;
-                        imm_ = get_imm_I();
-                        break;
-                    case 4:
-                        op_ = XORI;
-                        imm_ = get_imm_I();
-                        break;
-                    case 6:
-                        op_ = ORI;
-                        imm_ = get_imm_I();
-                        break;
-                    case 7:
-                        op_ = ANDI;
-                        imm_ = get_imm_I();
-                        break;
-                    case 1:
-                        op_ = SLLI;
-                        imm_ = get_imm_Iu();
-                        break;
-                    case 5:
-                        imm_ = get_imm_Iu();
-                        op_ = ((imm_ >> 10) & 1) ? SRAI : SRLI;
-                        break;
-                }
-                if (op_ == SRAI) imm_ = imm_ << 2 >> 2;
-                break;
-            case 0x33:
-                type_ = 'R';
-                funct3_ = get_funct3();
-                rd_ = get_rd();
-                rs1_ = get_rs1();
-                rs2_ = get_rs2();
-                funct7_ = get_funct7();
-                switch (funct3_) {
-                    case 0:
-                        op_ = ((funct7_ >> 5) & 1) ? SUB : ADD;
-                        break;
-                    case 1:
-                        op_ = SLL;
-                        break;
-                    case 2:
-                        op_ = SLT;
-                        break;
-                    case 3:
-                        op_ = SLTU;
-                        break;
-                    case 4:
-                        op_ = XOR;
-                        break;
-                    case 5:
-                        op_ = ((funct7_ >> 5) & 1) ? SRA : SRL;
-                        break;
-                    case 6:
-                        op_ = OR;
-                        break;
-                    case 7:
-                        op_ = AND;
-                        break;
-                }
-                break;
-        }
+        const DecodeEntry &e = Entry(order_);
+        type_ = e.type;
+        op_ = e.type == 'A' ? kDecodeTable.atomic[order_ >> 27] : e.op;
+        imm_ = Immediate(order_, e.imm);
+        rd_ = order_ >> 7 & 31 & Mask(e.fields, F_RD);
+        rs1_ = order_ >> 15 & 31 & Mask(e.fields, F_RS1);
+        rs2_ = order_ >> 20 & 31 & Mask(e.fields, F_RS2);
+        funct3_ = order_ >> 12 & 7 & Mask(e.fields, F_FUNCT3);
+        funct7_ = order_ >> 25 & Mask(e.fields, F_FUNCT7);
     }
 };
 
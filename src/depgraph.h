@@ -0,0 +1,121 @@
+#ifndef RISC_V_DEPGRAPH_H
+#define RISC_V_DEPGRAPH_H
+
+#include <string>
+#include <vector>
+#include "utils.h"
+#include "writer.h"
+
+// Dependency graph of the committed instruction stream, for critical-path
+// analysis offline (bench/critpath.cpp). Every ROB entry that retires
+// becomes one line, written at retirement through an async BufferedWriter:
+//   seq pc type insts commit fetch issue exec mem done src1 src2 store redirect
+// seq numbers every instruction queue entry, so it also tells which one
+// had to issue to make room for this one. type is the ROB entry's (E for a
+// move eliminated at rename, which needs no station). commit is the Clock
+// it retired at and fetch..done how many cycles before that it was
+// fetched, issued, began executing, went to memory (loads; otherwise as
+// exec) and put its result on the CDB (or was ready at issue). src1/src2
+// are its register producers and store the store a load forwarded from,
+// each as the distance back in retired entries, 0 for none or too far back
+// to matter. redirect is b (a mispredicted branch) or v (a mispredicted
+// load value) when fetch restarted after it retired, j (JALR) when fetch
+// waited for it to execute, - otherwise. Only a ring of in-flight entries
+// is kept, so memory stays flat however long the run.
+class DependencyRecorder {
+public:
+    static const int kRing = 1024; // > every fetch that can be in flight at once
+    static const u_int64_t kNone = ~0ull;
+
+private:
+    struct Node {
+        u_int64_t seq = kNone;
+        u_int64_t index = 0;                    // retirement order, once retired
+        u_int64_t src[3] = {kNone, kNone, kNone}; // register producers, forwarding store
+        int fetch = 0, issue = 0, exec = -1, mem = -1, done = -1;
+        char redirect = '-';
+        bool retired = false;
+    };
+
+    BufferedWriter out_;
+    const int *clock_ = nullptr;
+    Node node_[kRing];
+    std::vector<u_int64_t> writer_; // last issued producer of each physical register
+    u_int64_t retired_ = 0;
+
+public:
+    bool Open(const std::string &path, int hart, const int *clock, int rob, int rs, int lb, int isq, int regs) {
+        if (!out_.Open(path, true)) return false;
+        clock_ = clock;
+        writer_.assign(regs, (u_int64_t) kNone); // a copy: kNone has no definition
+        out_ << "# depgraph hart " << hart << " rob " << rob << " rs " << rs << " lb " << lb << " isq " << isq
+             << " clock " << *clock << '\n'
+             << "# seq pc type insts commit fetch issue exec mem done src1 src2 store redirect\n";
+        return true;
+    }
+
+    void Fetch(u_int64_t seq) {
+        Node &n = node_[seq % kRing];
+        n = Node();
+        n.seq = seq;
+        n.fetch = *clock_;
+    }
+
+    // Physical registers the instruction at seq reads, 0 for none; called
+    // before its own destination is renamed.
+    void Sources(u_int64_t seq, int p1, int p2) {
+        Node &n = node_[seq % kRing];
+        n.src[0] = p1 ? writer_[p1] : kNone;
+        n.src[1] = p2 ? writer_[p2] : kNone;
+    }
+
+    // It entered the ROB, writing preg (0: none, or a shared register);
+    // `ready` if it completed there.
+    void Issue(u_int64_t seq, int preg, bool ready) {
+        Node &n = node_[seq % kRing];
+        n.issue = *clock_;
+        if (ready) n.exec = n.mem = n.done = n.issue;
+        if (preg) writer_[preg] = seq;
+    }
+
+    // Pipeline trace stage (see PipelineTracer) of seq.
+    void Stage(u_int64_t seq, const char *stage) {
+        Node &n = node_[seq % kRing];
+        if (stage[0] == 'X') n.exec = *clock_;
+        else if (stage[0] == 'M') n.mem = *clock_;
+        else if (stage[0] == 'W') n.done = *clock_;
+    }
+
+    // Load seq took its value from store `from`.
+    void Forward(u_int64_t seq, u_int64_t from) { node_[seq % kRing].src[2] = from; }
+
+    void Redirect(u_int64_t seq, char why) { node_[seq % kRing].redirect = why; }
+
+    void Retire(u_int64_t seq, u_int32_t pc, char type, int insts) {
+        Node &n = node_[seq % kRing];
+        int commit = *clock_;
+        if (n.exec < 0) n.exec = commit; // an atomic: all of it happens at retirement
+        if (n.mem < 0) n.mem = n.exec;
+        if (n.done < 0) n.done = commit;
+        n.index = retired_++;
+        n.retired = true;
+        out_ << seq << ' ';
+        out_.Hex(pc) << ' ' << (type ? type : '?') << ' ' << insts << ' ' << commit << ' ' << commit - n.fetch
+                     << ' ' << commit - n.issue << ' ' << commit - n.exec << ' ' << commit - n.mem << ' '
+                     << commit - n.done;
+        for (u_int64_t s: n.src) out_ << ' ' << Distance(n, s);
+        out_ << ' ' << n.redirect << '\n';
+    }
+
+private:
+    u_int64_t Distance(const Node &n, u_int64_t seq) const {
+        if (seq == kNone) return (u_int64_t) 0;
+        const Node &p = node_[seq % kRing];
+        return p.seq == seq && p.retired ? n.index - p.index : 0;
+    }
+};
+
+std::string GraphPath;                              // --depgraph; hart h > 0 writes GraphPath.h
+thread_local DependencyRecorder *depGraph = nullptr; // this thread's core, when recording
+
+#endif //RISC_V_DEPGRAPH_H
@@ -0,0 +1,103 @@
+#ifndef RISC_V_ENERGY_H
+#define RISC_V_ENERGY_H
+
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+
+// Events the energy model charges for; Statistics::activity counts them.
+enum EnergyEvent {
+    kEnMemRead,         // instruction fetch from memory, load, atomic read
+    kEnMemWrite,        // store or atomic write performed
+    kEnRobWrite,        // entry allocated or result written
+    kEnRsWrite,         // station allocated or operand captured
+    kEnLbWrite,
+    kEnRsCompare,       // tag compares of a CDB broadcast, one per station
+    kEnLbCompare,
+    kEnCdbBroadcast,
+    kEnAluOp,           // ALU operation or address generation
+    kEnPredictLookup,
+    kEnPredictUpdate,
+    kEnFlush,
+    kEnergyEvents
+};
+
+static const char *const kEnergyEventName[kEnergyEvents] = {
+        "mem_read", "mem_write", "rob_write", "rs_write", "lb_write", "rs_cam_compare", "lb_cam_compare",
+        "cdb_broadcast", "alu_op", "predictor_lookup", "predictor_update", "flush"};
+
+// Activity-based energy: every event costs a fixed energy, and every cycle
+// a static energy that grows with the number of window entries (ROB, RS,
+// LB and physical registers), so bigger configurations pay for their size.
+// Energies are in pJ; the defaults are rough 45 nm-class figures meant for
+// comparing configurations with each other, not for absolute numbers.
+// --energy reads "<name> <value>" lines overriding them, where name is an
+// event name, static_per_cycle, static_per_entry or clock_ghz.
+struct EnergyModel {
+    double pj[kEnergyEvents] = {20, 20, 2, 1.5, 1.5, 0.15, 0.15, 4, 1, 1, 1.5, 10};
+    double staticPerCycle = 10;  // pJ every cycle (clock tree, fixed logic)
+    double staticPerEntry = 0.05; // pJ every cycle per window entry
+    double ghz = 1;
+
+    bool Load(const std::string &path) {
+        std::ifstream in(path);
+        if (!in) {
+            std::cerr << "cannot open " << path << '\n';
+            return false;
+        }
+        std::string line;
+        while (std::getline(in, line)) {
+            std::istringstream fields(line);
+            std::string name;
+            double value;
+            if (!(fields >> name) || name[0] == '#') continue;
+            if (!(fields >> value) || value < 0) {
+                std::cerr << path << ": bad value for " << name << '\n';
+                return false;
+            }
+            if (!Set(name, value)) {
+                std::cerr << path << ": unknown energy " << name << '\n';
+                return false;
+            }
+        }
+        if (ghz <= 0) {
+            std::cerr << path << ": clock_ghz must be positive\n";
+            return false;
+        }
+        return true;
+    }
+
+    // pJ of the events counted in activity.
+    double Dynamic(const u_int64_t *activity) const {
+        double e = 0;
+        for (int i = 0; i < kEnergyEvents; ++i) e += pj[i] * activity[i];
+        return e;
+    }
+
+    // pJ of `cycles` cycles of a window with `entries` entries.
+    double Static(u_int64_t cycles, int entries) const {
+        return (staticPerCycle + staticPerEntry * entries) * cycles;
+    }
+
+    double Microseconds(u_int64_t cycles) const { return cycles / ghz / 1e3; }
+
+private:
+    bool Set(const std::string &name, double value) {
+        for (int i = 0; i < kEnergyEvents; ++i) {
+            if (name == kEnergyEventName[i]) {
+                pj[i] = value;
+                return true;
+            }
+        }
+        if (name == "static_per_cycle") staticPerCycle = value;
+        else if (name == "static_per_entry") staticPerEntry = value;
+        else if (name == "clock_ghz") ghz = value;
+        else return false;
+        return true;
+    }
+};
+
+EnergyModel energyModel; // --energy, shared by all cores
+
+#endif //RISC_V_ENERGY_H
@@ -0,0 +1,119 @@
+#ifndef RISC_V_FUNCTIONAL_H
+#define RISC_V_FUNCTIONAL_H
+
+#include <iostream>
+#include <cstring>
+#include "alu.h"
+#include "decode.h"
+#include "memory.h"
+#include "utils.h"
+
+// Guest architectural state. Plain struct so jitted code can address the
+// registers directly off one base pointer.
+struct GuestContext {
+    u_int32_t reg[32];
+    u_int32_t pc;
+    u_int32_t smc;        // store address that hit a page holding jitted code
+    u_int64_t instret;
+    byte *mem;            // Memory backing store
+    const u_int8_t *code; // per-region "has jitted code" flags
+};
+
+// In-order functional model: one Step() retires exactly one instruction,
+// with no timing. Shares Decode/ALU with the Tomasulo core so both models
+// agree on every instruction's semantics.
+template<int memSize>
+class FunctionalCore {
+public:
+    GuestContext ctx_;
+    Memory<memSize> &mem_;
+
+    explicit FunctionalCore(Memory<memSize> &mem) : mem_(mem) {
+        memset(&ctx_, 0, sizeof ctx_);
+        ctx_.mem = mem.data();
+    }
+
+    bool Halted() { return mem_.readWord(ctx_.pc) == 0x0ff00513u; }
+
+    u_int32_t Result() const { return ctx_.reg[10] & 255u; }
+
+    // Executes the instruction at ctx_.pc. Returns the store address when the
+    // instruction wrote memory (for SMC detection), or memSize otherwise.
+    u_int32_t Step() {
+        u_int32_t pc = ctx_.pc, order = mem_.readWord(pc);
+        Decode decoder;
+        decoder.SetOrder(order);
+        decoder.decode();
+        ALU alu;
+        u_int32_t next = pc + 4, stored = memSize;
+        u_int32_t r1 = ctx_.reg[decoder.rs1_], r2 = ctx_.reg[decoder.rs2_];
+        switch (decoder.type_) {
+            case 'U':
+                Write(decoder.rd_, decoder.op_ == LUI ? decoder.imm_ : decoder.imm_ + pc);
+                break;
+            case 'J':
+                Write(decoder.rd_, pc + 4);
+                next = pc + decoder.imm_;
+                break;
+            case 'B':
+                if (alu.calc(decoder.op_, r1, r2)) next = pc + decoder.imm_;
+                break;
+            case 'L': {
+                u_int32_t addr = alu.calc(decoder.op_, r1, decoder.imm_);
+                if (decoder.op_ == LB) Write(decoder.rd_, decoder.sext(mem_.readByte(addr), 8));
+                else if (decoder.op_ == LH) Write(decoder.rd_, decoder.sext(mem_.readHfWord(addr), 16));
+                else if (decoder.op_ == LW) Write(decoder.rd_, mem_.readWord(addr));
+                else if (decoder.op_ == LBU) Write(decoder.rd_, mem_.readByte(addr));
+                else if (decoder.op_ == LHU) Write(decoder.rd_, mem_.readHfWord(addr));
+                break;
+            }
+            case 'S': {
+                stored = alu.calc(decoder.op_, r1, decoder.imm_);
+                if (decoder.op_ == SB) mem_.writeByte(stored, r2 & 0xff);
+                else if (decoder.op_ == SH) mem_.writeHfWord(stored, r2 & 0xffff);
+                else if (decoder.op_ == SW) mem_.writeWord(stored, r2);
+                break;
+            }
+            case 'I':
+                if (decoder.op_ == JALR) {
+                    next = alu.calc(JALR, r1, decoder.imm_);
+                    Write(decoder.rd_, pc + 4);
+                } else Write(decoder.rd_, alu.calc(decoder.op_, r1, decoder.imm_));
+                break;
+            case 'R':
+                Write(decoder.rd_, alu.calc(decoder.op_, r1, r2));
+                break;
+            case 'A': {
+                u_int32_t old = mem_.readWord(r1);
+                if (decoder.op_ == LR_W) {
+                    reserved_ = true, reservation_ = r1;
+                    Write(decoder.rd_, old);
+                } else if (decoder.op_ == SC_W) {
+                    bool ok = reserved_ && reservation_ == r1;
+                    if (ok) mem_.writeWord(stored = r1, r2);
+                    reserved_ = false;
+                    Write(decoder.rd_, !ok);
+                } else if (decoder.op_ != NOPE) {
+                    mem_.writeWord(stored = r1, alu.calc(decoder.op_, old, r2));
+                    Write(decoder.rd_, old);
+                }
+                break;
+            }
+            default: // unknown encodings retire as nops
+                break;
+        }
+        ctx_.pc = next;
+        ++ctx_.instret;
+        return stored;
+    }
+
+private:
+    bool reserved_ = false;   // LR.W reservation
+    u_int32_t reservation_ = 0;
+
+    void Write(u_int8_t rd, u_int32_t val) {
+        if (rd) ctx_.reg[rd] = val;
+    }
+};
+
+#endif //RISC_V_FUNCTIONAL_H
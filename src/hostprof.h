@@ -0,0 +1,156 @@
+#ifndef RISC_V_HOSTPROF_H
+#define RISC_V_HOSTPROF_H
+
+// Host-side profile of the simulator's own loop, built only with
+// -DRISCV_HOST_PROFILE (cmake -DHOST_PROFILE=ON). Each HOST_SCOPE(stage)
+// adds the TSC ticks spent in its block to that stage; sub-operations are
+// timed inside their stage, so their time is also part of it. Reading the
+// TSC is not free (tens of ns where the hypervisor traps it), so only a
+// random 1/kSampleRate of the steps of the main loop are timed and the
+// stages are scaled up by steps/sampled; the loop as a whole (HOST_TOTAL)
+// is always timed. A timed step is also timed as a whole (kHostStep), and
+// "other" is that minus its stages, so both come from the same samples.
+// What the timer itself adds (one read per scope, two per scope nested in
+// it) is taken off at a cost per read that the run itself gives: the timed
+// steps cost more than the rest by exactly what their reads add. Ticks are
+// turned into ns against steady_clock over the whole run, and
+// Simulator::Report prints ns per simulated cycle and per committed
+// instruction for each stage. Without the flag the macros are empty.
+
+#include <iostream>
+
+#ifdef RISCV_HOST_PROFILE
+
+#include <algorithm>
+#include <chrono>
+#include <mutex>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+enum HostStage {
+    kHostLoop, // all of RunUntil, timed on every step
+    kHostStep, // one step of it, sampled; what the stages below leave is reported as "other"
+    kHostCommit, kHostWriteResult, kHostExecute, kHostIssue, kHostShuffle, kHostSkip,
+    // sub-operations
+    kHostFetch, kHostDecode, kHostRsSelect, kHostLbForward, kHostWakeup,
+    kHostStages
+};
+
+static const char *const kHostStageName[kHostStages] = {
+        "total", "step", "commit", "write_result", "execute", "issue", "shuffle", "idle_skip",
+        "fetch", "decode", "rs_select", "lb_forward", "wakeup"};
+
+inline u_int64_t HostTicks() {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#else
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+}
+
+class HostProfiler {
+public:
+    static const int kSampleRate = 64;
+
+    u_int64_t ticks_[kHostStages]; // timer reads included
+    u_int64_t reads_[kHostStages]; // timer reads inside those ticks
+    u_int64_t opened_ = 0;  // timed scopes so far
+    u_int64_t steps_ = 0;   // iterations of the main loop
+    u_int64_t sampled_ = 0; // of which timed
+    u_int32_t random_ = 2463534242u;
+    bool on_ = false;       // timing this step
+
+    constexpr HostProfiler() : ticks_(), reads_() {}
+
+    // Start of a main loop step: decides whether it is timed.
+    void Step() {
+        random_ ^= random_ << 13, random_ ^= random_ >> 17, random_ ^= random_ << 5;
+        on_ = random_ % kSampleRate == 0;
+        ++steps_;
+        sampled_ += on_;
+    }
+
+    void Add(const HostProfiler &other) {
+        for (int s = 0; s < kHostStages; ++s) ticks_[s] += other.ticks_[s], reads_[s] += other.reads_[s];
+        steps_ += other.steps_;
+        sampled_ += other.sampled_;
+    }
+
+    // Ticks one timer read adds. With u the ticks of an untimed step, the n
+    // timed steps out of N take S = n u + c R, R being their reads, and the
+    // loop L = N u + c (R + n), each step scope's own two reads falling
+    // inside it; solved for c.
+    double ReadCost() const {
+        double n = sampled_, N = steps_, R = reads_[kHostStep];
+        double S = ticks_[kHostStep], L = ticks_[kHostLoop], d = R * (N - n) - n * n;
+        return d > 0 ? std::max((S * N - n * L) / d, 0.0) : 0.0;
+    }
+
+    // Estimated ticks of stage s over all steps, timer reads taken off.
+    double Ticks(int s) const {
+        double t = std::max(ticks_[s] - ReadCost() * reads_[s], 0.0);
+        if (s == kHostLoop) return t;
+        return sampled_ ? t * steps_ / sampled_ : 0.0;
+    }
+};
+
+// Ticks -> ns, measured over the run.
+struct HostClock {
+    u_int64_t ticks = 0;
+    std::chrono::steady_clock::time_point time;
+    double nsPerTick = 0;
+
+    void Start() {
+        time = std::chrono::steady_clock::now();
+        ticks = HostTicks();
+    }
+
+    void Stop() {
+        double ns = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - time).count();
+        u_int64_t elapsed = HostTicks() - ticks;
+        nsPerTick = elapsed ? ns / elapsed : 0.0;
+    }
+};
+
+thread_local HostProfiler hostProfile; // this thread's core
+HostProfiler hostTotal;                // all cores, filled as they finish
+std::mutex hostTotalLock;
+HostClock hostClock;
+
+class HostScope {
+    HostStage stage_;
+    u_int64_t start_ = 0;
+    u_int64_t opened_ = 0;
+    bool on_;
+
+public:
+    HostScope(HostStage stage, bool on) : stage_(stage), on_(on) {
+        if (!on_) return;
+        opened_ = hostProfile.opened_++;
+        start_ = HostTicks();
+    }
+
+    ~HostScope() {
+        if (!on_) return;
+        hostProfile.ticks_[stage_] += HostTicks() - start_;
+        hostProfile.reads_[stage_] += 2 * (hostProfile.opened_ - opened_) - 1;
+    }
+};
+
+#define HOST_SCOPE_NAME(line) host_scope_##line
+#define HOST_SCOPE_AT(stage, on, line) HostScope HOST_SCOPE_NAME(line)(stage, on)
+#define HOST_SCOPE(stage) HOST_SCOPE_AT(stage, hostProfile.on_, __LINE__)
+#define HOST_TOTAL() HOST_SCOPE_AT(kHostLoop, true, __LINE__)
+#define HOST_STEP() hostProfile.Step()
+
+#else
+
+#define HOST_SCOPE(stage)
+#define HOST_TOTAL()
+#define HOST_STEP()
+
+#endif
+
+#endif //RISC_V_HOSTPROF_H
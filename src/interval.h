@@ -0,0 +1,80 @@
+#ifndef RISC_V_INTERVAL_H
+#define RISC_V_INTERVAL_H
+
+#include <string>
+#include "stats.h"
+#include "writer.h"
+
+// Phase statistics: one CSV row per interval of `period` cycles (or
+// committed instructions) with what happened in that interval alone. Rows
+// are taken after a whole cycle, so an interval that ends inside a skipped
+// idle stretch or a two-instruction commit runs slightly long; the row
+// gives its true length. Energy comes from energyModel with the core's
+// window of `entries` entries. The file goes through an async BufferedWriter.
+class IntervalRecorder {
+    BufferedWriter out_;
+    u_int64_t period_ = 0;
+    bool byInsts_ = false;
+    u_int64_t next_ = 0;    // cycle or instruction count that closes the interval
+    int clock_ = 0;         // Clock at the start of the interval
+    int entries_ = 0;       // window entries, for static energy
+    Statistics last_;       // counters at the start of the interval
+
+public:
+    bool Open(const std::string &path, u_int64_t period, bool byInsts, int clock, int entries) {
+        if (!out_.Open(path, true)) return false;
+        period_ = period;
+        byInsts_ = byInsts;
+        clock_ = clock;
+        entries_ = entries;
+        next_ = (byInsts_ ? 0 : clock) + period_;
+        out_ << "cycle,cycles,instructions,ipc,branches,mispredicts,mispredict_rate,"
+                "rob_occupancy,rs_occupancy,lb_occupancy,flushes,squashed,frontend_bubbles,backend_stalls,"
+                "ftq_occupancy,energy_nj,power_mw\n";
+        return true;
+    }
+
+    // Called once per simulated step with the core's clock and counters.
+    void Sample(int clock, const Statistics &now) {
+        if ((byInsts_ ? now.committed : (u_int64_t) clock) < next_) return;
+        Row(clock, now);
+        next_ = (byInsts_ ? now.committed : (u_int64_t) clock) + period_;
+    }
+
+    // The partial interval at the end of the run.
+    void Finish(int clock, const Statistics &now) {
+        if (clock > clock_) Row(clock, now);
+        out_.Close();
+    }
+
+private:
+    void Row(int clock, const Statistics &now) {
+        u_int64_t cycles = clock - clock_;
+        u_int64_t committed = now.committed - last_.committed;
+        u_int64_t branches = now.branches - last_.branches;
+        u_int64_t mispredicts = now.mispredicts - last_.mispredicts;
+        u_int64_t activity[kEnergyEvents];
+        for (int e = 0; e < kEnergyEvents; ++e) activity[e] = now.activity[e] - last_.activity[e];
+        double nj = (energyModel.Dynamic(activity) + energyModel.Static(cycles, entries_)) / 1e3;
+        out_ << (u_int64_t) clock << ',' << cycles << ',' << committed << ',';
+        out_.Fixed(1.0 * committed / cycles, 3) << ',' << branches << ',' << mispredicts << ',';
+        out_.Fixed(branches ? 1.0 * mispredicts / branches : 0.0, 4) << ',';
+        out_.Fixed(1.0 * (now.robOccupancy - last_.robOccupancy) / cycles, 2) << ',';
+        out_.Fixed(1.0 * (now.rsOccupancy - last_.rsOccupancy) / cycles, 2) << ',';
+        out_.Fixed(1.0 * (now.lbOccupancy - last_.lbOccupancy) / cycles, 2) << ','
+            << now.flushes - last_.flushes << ',' << now.squashed - last_.squashed << ','
+            << now.frontendBubbles - last_.frontendBubbles << ',' << now.backendStalls - last_.backendStalls << ',';
+        out_.Fixed(1.0 * (now.ftqOccupancy - last_.ftqOccupancy) / cycles, 2) << ',';
+        out_.Fixed(nj, 3) << ',';
+        out_.Fixed(nj / energyModel.Microseconds(cycles), 3) << '\n';
+        clock_ = clock;
+        last_ = now;
+    }
+};
+
+std::string IntervalPath;          // --intervals; hart h > 0 writes IntervalPath.h
+u_int64_t IntervalPeriod = 10000;  // --interval / --interval-insts
+bool IntervalByInsts = false;      // period counts committed instructions
+thread_local IntervalRecorder *intervals = nullptr; // this thread's core, when recording
+
+#endif //RISC_V_INTERVAL_H
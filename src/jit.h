@@ -0,0 +1,381 @@
+#ifndef RISC_V_JIT_H
+#define RISC_V_JIT_H
+
+#include <algorithm>
+#include <cstddef>
+#include <iomanip>
+#include <sys/mman.h>
+#include <unordered_map>
+#include <vector>
+#include "functional.h"
+
+// Template JIT: hot RV32I basic blocks are translated to x86-64, cold code
+// runs on the FunctionalCore interpreter.
+//
+// Jitted blocks take the GuestContext in rdi and only touch caller-saved
+// registers (rax, rcx, rdx, r10, r11), so a chained exit is a plain jmp into
+// the next block. r11 holds the Memory backing store, r10 the code-page flags.
+// A block returns to the dispatcher with an exit code in eax.
+template<int memSize>
+class JitEngine {
+    static_assert((memSize & (memSize - 1)) == 0, "memory size must be a power of two");
+
+    static const int kHot = 16;              // interpreted entries before a block is compiled
+    static const int kMaxBlock = 64;         // guest instructions per block
+    static const int kMaxBlockBytes = kMaxBlock * 96 + 128;
+    static const int kCacheSize = 4 << 20;   // bytes of host code before the cache is flushed
+    static const int kPageBits = 8;          // SMC tracking granularity (256 B)
+
+    enum ExitCode { kExitIndirect = 0, kExitSmc = 1, kExitChain = 2 };
+
+    struct Block {
+        u_int8_t *code = nullptr;
+        u_int32_t start = 0, end = 0;   // guest range [start, end)
+        std::vector<int> incoming;      // exits chained into this block
+    };
+
+    struct Exit {
+        u_int32_t target = 0;
+        u_int8_t *site = nullptr;       // rel32 of the chainable jmp
+        u_int8_t *stub = nullptr;       // unchained destination of that jmp
+    };
+
+    FunctionalCore<memSize> core_;
+    u_int8_t *cache_ = nullptr;
+    u_int8_t *p_ = nullptr;             // emit cursor
+    std::unordered_map<u_int32_t, Block> blocks_;
+    std::unordered_map<u_int32_t, int> heat_;
+    std::vector<Exit> exits_;
+    std::vector<u_int8_t> pages_;
+    std::vector<std::vector<u_int32_t>> pageBlocks_;
+
+public:
+    u_int64_t compiled_ = 0, chained_ = 0, flushes_ = 0, invalidated_ = 0;
+
+    explicit JitEngine(Memory<memSize> &mem) : core_(mem) {
+        pages_.assign(memSize >> kPageBits, 0);
+        pageBlocks_.resize(memSize >> kPageBits);
+        core_.ctx_.code = pages_.data();
+        void *buf = mmap(nullptr, kCacheSize, PROT_READ | PROT_WRITE | PROT_EXEC,
+                         MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (buf != MAP_FAILED) cache_ = p_ = static_cast<u_int8_t *>(buf);
+    }
+
+    ~JitEngine() {
+        if (cache_) munmap(cache_, kCacheSize);
+    }
+
+    GuestContext &Context() { return core_.ctx_; }
+
+    u_int32_t Result() const { return core_.Result(); }
+
+    void Report(std::ostream &os, double seconds) const {
+        u_int64_t instret = core_.ctx_.instret;
+        os << std::dec << std::fixed << std::setprecision(4)
+           << "instructions " << instret << '\n'
+           << "jit_blocks " << compiled_ << '\n'
+           << "jit_chained " << chained_ << '\n'
+           << "jit_flushes " << flushes_ << '\n'
+           << "jit_invalidated " << invalidated_ << '\n'
+           << "wall_seconds " << seconds << '\n'
+           << "host_mips " << (seconds > 0 ? instret / seconds / 1e6 : 0.0) << '\n';
+    }
+
+    void Run() {
+        GuestContext &ctx = core_.ctx_;
+        while (!core_.Halted()) {
+            auto it = blocks_.find(ctx.pc);
+            if (it != blocks_.end()) {
+                int code = reinterpret_cast<int (*)(GuestContext *)>(it->second.code)(&ctx);
+                if (code == kExitSmc) Invalidate(ctx.smc >> kPageBits);
+                else if (code >= kExitChain) Link(code - kExitChain);
+                continue;
+            }
+            if (++heat_[ctx.pc] >= kHot && Compile(ctx.pc)) continue;
+            for (int n = 0; n < kMaxBlock && !core_.Halted(); ++n) {
+                u_int32_t pc = ctx.pc, stored = core_.Step();
+                if (stored < memSize && pages_[stored >> kPageBits]) Invalidate(stored >> kPageBits);
+                if (ctx.pc != pc + 4) break;
+            }
+        }
+    }
+
+private:
+    // ---- code cache ----
+
+    void Flush() {
+        blocks_.clear();
+        exits_.clear();
+        for (auto &page: pageBlocks_) page.clear();
+        std::fill(pages_.begin(), pages_.end(), 0);
+        p_ = cache_;
+        ++flushes_;
+    }
+
+    void Patch(u_int8_t *site, u_int8_t *dest) {
+        int32_t rel = static_cast<int32_t>(dest - (site + 4));
+        memcpy(site, &rel, 4);
+    }
+
+    void Link(int slot) {
+        u_int32_t target = exits_[slot].target;
+        auto it = blocks_.find(target);
+        if (it == blocks_.end()) {
+            if (core_.Halted() || ++heat_[target] < kHot) return;
+            u_int64_t flushes = flushes_;
+            if (!Compile(target) || flushes != flushes_) return; // slot died with the old cache
+            it = blocks_.find(target);
+        }
+        Patch(exits_[slot].site, it->second.code);
+        it->second.incoming.push_back(slot);
+        ++chained_;
+    }
+
+    // Drops every block that overlaps a page just written by the guest.
+    void Invalidate(u_int32_t page) {
+        std::vector<u_int32_t> victims;
+        victims.swap(pageBlocks_[page]);
+        pages_[page] = 0;
+        for (u_int32_t start: victims) {
+            auto it = blocks_.find(start);
+            if (it == blocks_.end()) continue;
+            for (int slot: it->second.incoming) Patch(exits_[slot].site, exits_[slot].stub);
+            blocks_.erase(it);
+            heat_[start] = 0;
+            ++invalidated_;
+        }
+    }
+
+    // ---- x86-64 emitter ----
+
+    enum Reg { EAX = 0, ECX = 1, EDX = 2 };
+
+    void B(u_int8_t v) { *p_++ = v; }
+
+    void D(u_int32_t v) {
+        memcpy(p_, &v, 4);
+        p_ += 4;
+    }
+
+    static u_int32_t Off(size_t field) { return static_cast<u_int32_t>(field); }
+
+    static u_int32_t RegOff(int r) { return Off(offsetof(GuestContext, reg)) + 4 * r; }
+
+    void LoadReg(Reg dst, int r) { // dst = x[r]
+        if (!r) {
+            B(0x31), B(0xc0 | dst << 3 | dst); // xor dst, dst
+            return;
+        }
+        B(0x8b), B(0x80 | dst << 3 | 7), D(RegOff(r)); // mov dst, [rdi + disp32]
+    }
+
+    void StoreReg(int r, Reg src) { // x[r] = src
+        if (!r) return;
+        B(0x89), B(0x80 | src << 3 | 7), D(RegOff(r)); // mov [rdi + disp32], src
+    }
+
+    void StoreImm(u_int32_t off, u_int32_t imm) { // mov dword [rdi + off], imm32
+        B(0xc7), B(0x87), D(off), D(imm);
+    }
+
+    void AddInstret(u_int32_t n) { // add qword [rdi + instret], imm32
+        B(0x48), B(0x81), B(0x87), D(Off(offsetof(GuestContext, instret))), D(n);
+    }
+
+    void AluImm(u_int8_t ext, u_int32_t imm) { // <op> eax, imm32 (81 /ext)
+        B(0x81), B(0xc0 | ext << 3), D(imm);
+    }
+
+    void SetCC(u_int8_t cc) { // setcc al; movzx eax, al
+        B(0x0f), B(0x90 | cc), B(0xc0);
+        B(0x0f), B(0xb6), B(0xc0);
+    }
+
+    void Ret(u_int32_t code) { // mov eax, imm32; ret
+        B(0xb8), D(code);
+        B(0xc3);
+    }
+
+    // pc = target, then a jmp that starts out at a return-to-dispatcher stub
+    // and is later patched to jump straight into the target block.
+    void ExitDirect(u_int32_t target, u_int32_t retired) {
+        StoreImm(Off(offsetof(GuestContext, pc)), target);
+        AddInstret(retired);
+        B(0xe9);
+        Exit e;
+        e.target = target;
+        e.site = p_;
+        p_ += 4;
+        e.stub = p_;
+        Patch(e.site, e.stub);
+        Ret(kExitChain + exits_.size());
+        exits_.push_back(e);
+    }
+
+    void EffectiveAddr(int rs1, u_int32_t imm) { // eax = (x[rs1] + imm) masked into memory
+        LoadReg(EAX, rs1);
+        AluImm(0, imm);
+        AluImm(4, memSize - 1);
+    }
+
+    // Emits one non-control instruction; returns false if it can't be jitted.
+    bool EmitSimple(Decode &d, u_int32_t pc, u_int32_t retired) {
+        switch (d.type_) {
+            case 'U':
+                if (d.rd_) StoreImm(RegOff(d.rd_), d.op_ == LUI ? d.imm_ : d.imm_ + pc);
+                return true;
+            case 'L':
+                if (!d.rd_) return true;
+                EffectiveAddr(d.rs1_, d.imm_);
+                B(0x41);
+                if (d.op_ == LW) B(0x8b);
+                else {
+                    B(0x0f);
+                    if (d.op_ == LB) B(0xbe);
+                    else if (d.op_ == LBU) B(0xb6);
+                    else if (d.op_ == LH) B(0xbf);
+                    else B(0xb7);
+                }
+                B(0x04), B(0x03); // eax <- [r11 + rax]
+                StoreReg(d.rd_, EAX);
+                return true;
+            case 'S':
+                EffectiveAddr(d.rs1_, d.imm_);
+                LoadReg(ECX, d.rs2_);
+                if (d.op_ == SH) B(0x66);
+                B(0x41), B(d.op_ == SB ? 0x88 : 0x89), B(0x0c), B(0x03); // [r11 + rax] <- cl/cx/ecx
+                // SMC check: a store into a region holding jitted code leaves the block right after it
+                B(0x89), B(0xc2);                         // mov edx, eax
+                B(0xc1), B(0xea), B(kPageBits);           // shr edx, kPageBits
+                B(0x41), B(0x80), B(0x3c), B(0x12), B(0); // cmp byte [r10 + rdx], 0
+                {
+                    B(0x74), B(0);                        // je over
+                    u_int8_t *over = p_;
+                    B(0x89), B(0x87), D(Off(offsetof(GuestContext, smc))); // mov [rdi + smc], eax
+                    StoreImm(Off(offsetof(GuestContext, pc)), pc + 4);
+                    AddInstret(retired);
+                    Ret(kExitSmc);
+                    over[-1] = static_cast<u_int8_t>(p_ - over);
+                }
+                return true;
+            case 'I':
+                if (!d.rd_) return true;
+                LoadReg(EAX, d.rs1_);
+                switch (d.op_) {
+                    case ADDI: AluImm(0, d.imm_); break;
+                    case XORI: AluImm(6, d.imm_); break;
+                    case ORI: AluImm(1, d.imm_); break;
+                    case ANDI: AluImm(4, d.imm_); break;
+                    case SLTI: AluImm(7, d.imm_), SetCC(0xc); break; // cmp; setl
+                    case SLTIU: AluImm(7, d.imm_), SetCC(0x2); break; // cmp; setb
+                    case SLLI: B(0xc1), B(0xe0), B(d.imm_ & 31); break;
+                    case SRLI: B(0xc1), B(0xe8), B(d.imm_ & 31); break;
+                    case SRAI: B(0xc1), B(0xf8), B(d.imm_ & 31); break;
+                    default: return false;
+                }
+                StoreReg(d.rd_, EAX);
+                return true;
+            case 'R':
+                if (!d.rd_) return true;
+                LoadReg(EAX, d.rs1_);
+                LoadReg(ECX, d.rs2_);
+                switch (d.op_) {
+                    case ADD: B(0x01), B(0xc8); break;
+                    case SUB: B(0x29), B(0xc8); break;
+                    case XOR: B(0x31), B(0xc8); break;
+                    case OR: B(0x09), B(0xc8); break;
+                    case AND: B(0x21), B(0xc8); break;
+                    case SLL: B(0xd3), B(0xe0); break; // shl eax, cl
+                    case SRL: B(0xd3), B(0xe8); break;
+                    case SRA: B(0xd3), B(0xf8); break;
+                    case SLT: B(0x39), B(0xc8), SetCC(0xc); break;
+                    case SLTU: B(0x39), B(0xc8), SetCC(0x2); break;
+                    default: return false;
+                }
+                StoreReg(d.rd_, EAX);
+                return true;
+            default:
+                return false;
+        }
+    }
+
+    bool Compile(u_int32_t start) {
+#if defined(__x86_64__)
+        if (!cache_) return false;
+        if (p_ + kMaxBlockBytes > cache_ + kCacheSize) Flush();
+        Block block;
+        block.code = p_;
+        block.start = start;
+        B(0x4c), B(0x8b), B(0x9f), D(Off(offsetof(GuestContext, mem)));  // mov r11, [rdi + mem]
+        B(0x4c), B(0x8b), B(0x97), D(Off(offsetof(GuestContext, code))); // mov r10, [rdi + code]
+        u_int32_t pc = start;
+        int n = 0;
+        Memory<memSize> &mem = core_.mem_;
+        while (true) {
+            u_int32_t order = mem.readWord(pc);
+            Decode d;
+            d.SetOrder(order);
+            d.decode();
+            if (n == kMaxBlock || order == 0x0ff00513u) {
+                ExitDirect(pc, n);
+                break;
+            }
+            if (d.type_ == 'J') {
+                if (d.rd_) StoreImm(RegOff(d.rd_), pc + 4);
+                ExitDirect(pc + d.imm_, n + 1);
+                pc += 4;
+                break;
+            }
+            if (d.op_ == JALR) {
+                LoadReg(EAX, d.rs1_);
+                AluImm(0, d.imm_);
+                AluImm(4, 0xfffffffe);
+                if (d.rd_) StoreImm(RegOff(d.rd_), pc + 4);
+                B(0x89), B(0x87), D(Off(offsetof(GuestContext, pc))); // mov [rdi + pc], eax
+                AddInstret(n + 1);
+                Ret(kExitIndirect);
+                pc += 4;
+                break;
+            }
+            if (d.type_ == 'B') {
+                static const u_int8_t cc[] = {0, 0, 0, 0, 0, 0x4, 0x5, 0xc, 0xd, 0x2, 0x3}; // BEQ..BGEU
+                LoadReg(EAX, d.rs1_);
+                LoadReg(ECX, d.rs2_);
+                B(0x39), B(0xc8);                 // cmp eax, ecx
+                B(0x0f), B(0x80 | cc[d.op_]), D(0); // jcc taken
+                u_int8_t *taken = p_;
+                ExitDirect(pc + 4, n + 1);
+                Patch(taken - 4, p_);
+                ExitDirect(pc + d.imm_, n + 1);
+                pc += 4;
+                break;
+            }
+            u_int8_t *mark = p_;
+            if (!EmitSimple(d, pc, n + 1)) {
+                p_ = mark;
+                if (!n) { // nothing jittable here: leave it to the interpreter
+                    p_ = block.code;
+                    return false;
+                }
+                ExitDirect(pc, n);
+                break;
+            }
+            pc += 4;
+            ++n;
+        }
+        block.end = pc;
+        u_int32_t first = start >> kPageBits, last = ((pc - 1) & (memSize - 1)) >> kPageBits;
+        for (u_int32_t page = first; page <= last; ++page) {
+            pages_[page] = 1;
+            pageBlocks_[page].push_back(start);
+        }
+        blocks_[start] = block;
+        ++compiled_;
+        return true;
+#else
+        return false;
+#endif
+    }
+};
+
+#endif //RISC_V_JIT_H
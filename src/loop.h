@@ -0,0 +1,69 @@
+#ifndef RISC_V_LOOP_H
+#define RISC_V_LOOP_H
+
+#include "decode.h"
+#include "utils.h"
+
+// Loop buffer in front of instruction fetch. A taken backward branch or
+// jump whose body fits makes [target, branch] the buffered loop; from then
+// on every instruction fetched from memory inside that range is kept in
+// decoded form, and later fetches of it are served from here without a
+// memory read or a decode. A new loop found outside the current range
+// replaces it, so an enclosing loop that fits takes over from an inner one.
+class LoopBuffer {
+public:
+    static const int kMaxEntries = 64;
+
+    struct Slot {
+        Decode decoded;
+        bool filled = false;
+    };
+
+    u_int64_t loops_ = 0; // loops captured
+
+private:
+    Slot slot_[kMaxEntries];
+    int size_ = 32;       // entries in use, 0 when off
+    u_int32_t start_ = 0; // [start_, end_) is buffered
+    u_int32_t end_ = 0;
+
+public:
+    constexpr LoopBuffer() : slot_() {}
+
+    void Resize(int size) {
+        size_ = size;
+        start_ = end_ = 0;
+        loops_ = 0;
+    }
+
+    // The decoded instruction at pc, nullptr if it has to come from memory.
+    const Slot *Lookup(u_int32_t pc) const {
+        if (pc - start_ >= end_ - start_) return nullptr;
+        const Slot &s = slot_[(pc - start_) >> 2];
+        return s.filled ? &s : nullptr;
+    }
+
+    // Instruction d at pc was read from memory; fetch goes on at next.
+    void Fill(u_int32_t pc, const Decode &d, u_int32_t next) {
+        if (pc - start_ < end_ - start_) {
+            slot_[(pc - start_) >> 2] = {d, true};
+            return;
+        }
+        if (next >= pc || pc - next >= (u_int32_t) size_ * 4) return; // not a loop that fits
+        start_ = next;
+        end_ = pc + 4;
+        for (int i = 0; i < size_; ++i) slot_[i].filled = false;
+        slot_[(pc - start_) >> 2] = {d, true};
+        ++loops_;
+    }
+
+    // A store to addr retired: forget the loop if it wrote over it.
+    void Store(u_int32_t addr) {
+        if (addr + 4 > start_ && addr < end_) start_ = end_ = 0;
+    }
+};
+
+int LoopBufferSize = 32;            // --loop-buffer
+thread_local LoopBuffer loopBuffer; // this thread's core
+
+#endif //RISC_V_LOOP_H
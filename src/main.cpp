@@ -1,28 +1,417 @@
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <random>
+#include <sstream>
+#include <string>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <vector>
+#include "batch.h"
+#include "jit.h"
 #include "simulator.h"
 
-int main() {
-//    freopen("../sample/sample.data","r",stdin); // 94
-//    freopen("../testcases/array_test1.data","r",stdin); // 123
-//    freopen("../testcases/array_test2.data","r",stdin); // 43
-//    freopen("../testcases/basicopt1.data","r",stdin); // 88
-//    freopen("../testcases/bulgarian.data","r",stdin); // 159
-//    freopen("../testcases/expr.data","r",stdin); // 58
-//    freopen("../testcases/gcd.data","r",stdin); // 178
-//    freopen("../testcases/hanoi.data","r",stdin); // 20
-//    freopen("../testcases/lvalue2.data","r",stdin); // 175
-//    freopen("../testcases/magic.data","r",stdin); // 106
-//    freopen("../testcases/manyarguments.data","r",stdin); // 40
-//    freopen("../testcases/multiarray.data","r",stdin); // 115
-//    freopen("../testcases/naive.data","r",stdin); // 94
-//    freopen("../testcases/pi.data","r",stdin); // 137
-//    freopen("../testcases/qsort.data","r",stdin); // 105
-//    freopen("../testcases/queens.data","r",stdin); // 171
-//    freopen("../testcases/statement_test.data","r",stdin); // 50
-    freopen("../testcases/superloop.data","r",stdin); // 134
-//    freopen("../testcases/tak.data","r",stdin); // 186
-//    freopen("myAns.txt", "w", stdout);
+// --fuse argument: "all", "none" or a comma-separated subset of
+// lui,call,shadd,branch. Returns the FusionKind mask, -1 if malformed.
+static int ParseFusion(const std::string &list) {
+    if (list == "all") return kFuseAll;
+    if (list == "none") return 0;
+    int kinds = 0;
+    std::istringstream in(list);
+    std::string name;
+    while (std::getline(in, name, ',')) {
+        if (name == "lui") kinds |= kFuseLui;
+        else if (name == "call") kinds |= kFuseCall;
+        else if (name == "shadd") kinds |= kFuseShiftAdd;
+        else if (name == "branch") kinds |= kFuseBranch;
+        else return -1;
+    }
+    return kinds;
+}
+
+static int ParsePrefetch(const std::string &list) {
+    if (list == "all") return kPrefetchAll;
+    if (list == "none") return 0;
+    int kinds = 0;
+    std::istringstream in(list);
+    std::string name;
+    while (std::getline(in, name, ',')) {
+        if (name == "stride") kinds |= kPrefetchStride;
+        else if (name == "stream") kinds |= kPrefetchStream;
+        else return -1;
+    }
+    return kinds;
+}
+
+// --batch-args file: one instance per line, its whitespace-separated
+// numbers being the initial a0, a1, ... (at most a0..a7).
+static bool ReadBatchArgs(const char *path, std::vector<std::vector<u_int32_t>> &inputs) {
+    std::ifstream in(path);
+    if (!in) return false;
+    std::string line;
+    while (std::getline(in, line)) {
+        std::istringstream fields(line);
+        std::vector<u_int32_t> args;
+        std::string field;
+        while (fields >> field) args.push_back(strtoul(field.c_str(), nullptr, 0));
+        if (!args.empty()) inputs.push_back(args);
+    }
+    return true;
+}
+
+// What the command line sets besides the simulator's own globals.
+struct Options {
+    bool jit = false, skipIdle = true, report = false, check = false;
+    unsigned seed = std::random_device()();
+    int harts = 1, quantum = 1000;
+    const char *data = nullptr;
+    std::vector<std::vector<u_int32_t>> batch;
+    u_int64_t forkAt = 0;             // --fork-at
+    std::vector<std::string> configs; // --fork-config, one child each
+};
+
+// Applies argv[first..argc) to opts and the simulator globals; false after
+// saying what is wrong.
+static bool ParseArgs(int argc, char *argv[], int first, Options &opts) {
+    for (int i = first; i < argc; ++i) {
+        if (!strcmp(argv[i], "--jit")) opts.jit = true;
+        else if (!strcmp(argv[i], "--seed") && i + 1 < argc) opts.seed = strtoul(argv[++i], nullptr, 0);
+        else if (!strcmp(argv[i], "--no-skip")) opts.skipIdle = false;
+        else if (!strcmp(argv[i], "--no-elim")) Eliminate = false;
+        else if (!strcmp(argv[i], "--fuse") && i + 1 < argc) {
+            Fusion = ParseFusion(argv[++i]);
+            if (Fusion < 0) {
+                std::cerr << "--fuse takes all, none or a list of lui,call,shadd,branch\n";
+                return false;
+            }
+        } else if (!strcmp(argv[i], "--stats")) opts.report = true;
+        else if (!strcmp(argv[i], "--energy") && i + 1 < argc) {
+            if (!energyModel.Load(argv[++i])) return false;
+        } else if (!strcmp(argv[i], "--cosim")) opts.check = true;
+        else if (!strcmp(argv[i], "--cores") && i + 1 < argc) opts.harts = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--quantum") && i + 1 < argc) opts.quantum = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--rs") && i + 1 < argc) window.rs = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--lb") && i + 1 < argc) window.lb = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--rob") && i + 1 < argc) window.rob = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--prf") && i + 1 < argc) window.prf = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--loop-buffer") && i + 1 < argc) LoopBufferSize = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--ftq") && i + 1 < argc) FtqSize = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--miss-latency") && i + 1 < argc) cacheConfig.missLatency = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--prefetch") && i + 1 < argc) {
+            cacheConfig.prefetch = ParsePrefetch(argv[++i]);
+            if (cacheConfig.prefetch < 0) {
+                std::cerr << "--prefetch takes all, none or a list of stride,stream\n";
+                return false;
+            }
+        } else if (!strcmp(argv[i], "--prefetch-degree") && i + 1 < argc) cacheConfig.degree = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--prefetch-mshr") && i + 1 < argc) cacheConfig.outstanding = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--value-predict") && i + 1 < argc) {
+            std::string mode = argv[++i];
+            if (mode == "last") valueConfig.mode = kValueLast;
+            else if (mode == "stride") valueConfig.mode = kValueStride;
+            else {
+                std::cerr << "--value-predict takes last or stride\n";
+                return false;
+            }
+        } else if (!strcmp(argv[i], "--value-confidence") && i + 1 < argc) valueConfig.threshold = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "--trace") && i + 1 < argc) TracePath = argv[++i];
+        else if (!strcmp(argv[i], "--depgraph") && i + 1 < argc) GraphPath = argv[++i];
+        else if (!strcmp(argv[i], "--intervals") && i + 1 < argc) IntervalPath = argv[++i];
+        else if (!strcmp(argv[i], "--interval") && i + 1 < argc) {
+            IntervalPeriod = strtoull(argv[++i], nullptr, 0);
+            IntervalByInsts = false;
+        } else if (!strcmp(argv[i], "--interval-insts") && i + 1 < argc) {
+            IntervalPeriod = strtoull(argv[++i], nullptr, 0);
+            IntervalByInsts = true;
+        } else if (!strcmp(argv[i], "--profile") && i + 1 < argc) ProfilePath = argv[++i];
+        else if (!strcmp(argv[i], "--symbols") && i + 1 < argc) SymbolPath = argv[++i];
+        else if (!strcmp(argv[i], "--batch") && i + 1 < argc) {
+            int n = atoi(argv[++i]);
+            opts.batch.clear();
+            for (int k = 0; k < n; ++k) opts.batch.push_back({(u_int32_t) k});
+            if (n < 1) {
+                std::cerr << "--batch must be positive\n";
+                return false;
+            }
+        } else if (!strcmp(argv[i], "--batch-args") && i + 1 < argc) {
+            opts.batch.clear();
+            if (!ReadBatchArgs(argv[++i], opts.batch) || opts.batch.empty()) {
+                std::cerr << "cannot read instances from " << argv[i] << '\n';
+                return false;
+            }
+        }
+        else if (!strcmp(argv[i], "--fork-at") && i + 1 < argc) opts.forkAt = strtoull(argv[++i], nullptr, 0);
+        else if (!strcmp(argv[i], "--fork-config") && i + 1 < argc) opts.configs.push_back(argv[++i]);
+        else if (!strncmp(argv[i], "--", 2)) {
+            std::cerr << "unknown option " << argv[i] << ", or it lacks its argument\n";
+            return false;
+        } else opts.data = argv[i];
+    }
+    return true;
+}
+
+// The settings as a whole: false after saying what is wrong.
+static bool CheckArgs(const Options &opts) {
+    if (opts.harts < 1 || opts.harts > CoherentMemory<size>::kMaxHarts || opts.quantum < 1) {
+        std::cerr << "--cores must be 1.." << CoherentMemory<size>::kMaxHarts << " and --quantum positive\n";
+        return false;
+    }
+    if (window.rs < 1 || window.rs > WindowConfig::kMaxStations || window.lb < 1 ||
+        window.lb > WindowConfig::kMaxStations || window.rob < 1 || window.rob > WindowConfig::kMaxRob ||
+        (window.rob & (window.rob - 1))) {
+        std::cerr << "--rs and --lb must be 1.." << WindowConfig::kMaxStations << ", --rob a power of two 1.."
+                  << WindowConfig::kMaxRob << '\n';
+        return false;
+    }
+    if (window.prf && (window.prf < 33 || window.prf > WindowConfig::kMaxPhys)) {
+        std::cerr << "--prf must be 33.." << WindowConfig::kMaxPhys << '\n';
+        return false;
+    }
+    if (FtqSize < 1 || FtqSize > FetchTargetQueue::kMaxBlocks || (FtqSize & (FtqSize - 1))) {
+        std::cerr << "--ftq must be a power of two 1.." << FetchTargetQueue::kMaxBlocks << '\n';
+        return false;
+    }
+    if (!IntervalPeriod) {
+        std::cerr << "--interval and --interval-insts must be positive\n";
+        return false;
+    }
+    if (LoopBufferSize < 0 || LoopBufferSize > LoopBuffer::kMaxEntries) {
+        std::cerr << "--loop-buffer must be 0.." << LoopBuffer::kMaxEntries << '\n';
+        return false;
+    }
+    if (cacheConfig.missLatency < 0 || cacheConfig.missLatency > 1000 || cacheConfig.degree < 1 ||
+        cacheConfig.degree > 8 || cacheConfig.outstanding < 1 || cacheConfig.outstanding > DataCache::kMaxOutstanding) {
+        std::cerr << "--miss-latency must be 0..1000, --prefetch-degree 1..8 and --prefetch-mshr 1.."
+                  << DataCache::kMaxOutstanding << '\n';
+        return false;
+    }
+    if (valueConfig.threshold < 0 || valueConfig.threshold > LoadValuePredictor::kMaxConfidence) {
+        std::cerr << "--value-confidence must be 0.." << LoadValuePredictor::kMaxConfidence << '\n';
+        return false;
+    }
+    if (opts.harts > 1 && (opts.jit || opts.check)) {
+        std::cerr << "--jit and --cosim model a single core\n";
+        return false;
+    }
+    if (!opts.batch.empty() && (opts.jit || opts.check || opts.harts > 1)) {
+        std::cerr << "--batch runs functionally, without --jit, --cosim or --cores\n";
+        return false;
+    }
+    if (!opts.configs.empty() && (opts.jit || opts.check || opts.harts > 1 || !opts.batch.empty())) {
+        std::cerr << "--fork-config runs the single-core model, without --jit, --cosim, --cores or --batch\n";
+        return false;
+    }
+    if (opts.forkAt && opts.configs.empty()) {
+        std::cerr << "usage: --fork-at N --fork-config \"args\" [--fork-config \"args\"]...\n";
+        return false;
+    }
+    return true;
+}
+
+// --fork-config child number index: applies config on top of the parent's
+// settings and simulates on from the warm start, writing the result and its
+// stats to fd. Returns the exit status.
+static int RunConfig(Options opts, const std::string &config, int index, int fd) {
+    std::istringstream in(config);
+    std::vector<std::string> words{"code"};
+    std::string word;
+    while (in >> word) words.push_back(word);
+    std::vector<char *> args;
+    for (auto &w: words) args.push_back(&w[0]);
+    const char *data = opts.data;
+    opts.configs.clear(); // the parent's; config may not set them again
+    opts.forkAt = 0;
+    if (index) { // the outputs inherited from the parent, as hart h > 0 does
+        for (std::string *path: {&TracePath, &GraphPath, &IntervalPath, &ProfilePath})
+            if (!path->empty()) *path += "." + std::to_string(index);
+    }
+    if (!ParseArgs(args.size(), args.data(), 1, opts)) return 1;
+    if (opts.data != data || !opts.configs.empty() || opts.forkAt || opts.harts > 1 || opts.jit || opts.check ||
+        !opts.batch.empty()) {
+        std::cerr << "--fork-config \"" << config << "\": only core settings can differ\n";
+        return 1;
+    }
+    if (!CheckArgs(opts)) return 1;
+    if (dup2(fd, STDOUT_FILENO) < 0) return 1;
+    auto begin = std::chrono::steady_clock::now();
+    Simulator::Run(opts.seed, opts.skipIdle, 1, 1000);
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+    Simulator::Report(std::cout, seconds);
+    std::cout.flush();
+    return 0;
+}
+
+// Runs the first forkAt instructions once, functionally, then forks one
+// child per configuration. The children share the warmed memory copy-on-
+// write and run detailed simulation from there at the same time; their
+// results and stats are printed as one table, a column per configuration.
+static int ForkServer(const Options &opts) {
+    FunctionalCore<size> warm(memory);
+    while (warm.ctx_.instret < opts.forkAt && !warm.Halted()) warm.Step();
+    warmStart.valid = true;
+    warmStart.pc = warm.ctx_.pc;
+    for (int r = 0; r < 32; ++r) warmStart.reg[r] = warm.ctx_.reg[r];
+    std::cout.flush();
+
+    std::vector<pid_t> children;
+    std::vector<int> pipes;
+    for (size_t k = 0; k < opts.configs.size(); ++k) {
+        int fd[2];
+        if (pipe(fd)) {
+            perror("pipe");
+            return 1;
+        }
+        pid_t pid = fork();
+        if (pid < 0) {
+            perror("fork");
+            return 1;
+        }
+        if (!pid) {
+            close(fd[0]);
+            _exit(RunConfig(opts, opts.configs[k], k, fd[1]));
+        }
+        close(fd[1]);
+        children.push_back(pid);
+        pipes.push_back(fd[0]);
+    }
+
+    // "<name> <value>" lines, or the result alone, in the first child's order
+    std::vector<std::string> names;
+    std::vector<std::map<std::string, std::string>> columns(children.size());
+    int failed = 0;
+    for (size_t k = 0; k < children.size(); ++k) {
+        std::string text;
+        char buffer[4096];
+        ssize_t n;
+        while ((n = read(pipes[k], buffer, sizeof buffer)) > 0) text.append(buffer, n);
+        close(pipes[k]);
+        int status;
+        waitpid(children[k], &status, 0);
+        if (!WIFEXITED(status) || WEXITSTATUS(status)) ++failed;
+        std::istringstream lines(text);
+        std::string line;
+        while (std::getline(lines, line)) {
+            std::istringstream fields(line);
+            std::string name, value;
+            if (!(fields >> name)) continue;
+            if (!(fields >> value)) value = name, name = "result";
+            if (std::find(names.begin(), names.end(), name) == names.end()) names.push_back(name);
+            columns[k][name] = value;
+        }
+    }
+    std::cout << "fast-forwarded " << warm.ctx_.instret << " instructions to pc 0x" << std::hex
+              << warmStart.pc << std::dec << '\n';
+    for (size_t k = 0; k < opts.configs.size(); ++k)
+        std::cout << "config " << k << ": " << opts.configs[k] << '\n';
+    std::cout << std::left << std::setw(28) << "stat" << std::right;
+    for (size_t k = 0; k < columns.size(); ++k) std::cout << std::setw(16) << "config " + std::to_string(k);
+    std::cout << '\n';
+    for (auto &name: names) {
+        std::cout << std::left << std::setw(28) << name << std::right;
+        for (auto &column: columns) {
+            auto it = column.find(name);
+            std::cout << std::setw(16) << (it == column.end() ? "-" : it->second);
+        }
+        std::cout << '\n';
+    }
+    return failed ? 1 : 0;
+}
+
+// usage: code [--jit] [--seed N] [--no-skip] [--no-elim] [--fuse kinds]
+//             [--stats [--energy file]] [--cosim]
+//             [--cores N] [--quantum Q] [--rs N] [--lb N] [--rob N] [--prf N]
+//             [--loop-buffer N] [--ftq N]
+//             [--miss-latency N [--prefetch kinds] [--prefetch-degree N] [--prefetch-mshr N]]
+//             [--value-predict last|stride [--value-confidence N]]
+//             [--trace file.kanata] [--depgraph file.dep]
+//             [--intervals file.csv [--interval N | --interval-insts N]]
+//             [--profile prefix [--symbols nm.txt]]
+//             [--batch N | --batch-args file]
+//             [--fork-at N --fork-config "args" [--fork-config "args"]...] [file.data]
+// Reads the program from file.data, or from stdin when no file is given.
+// --no-elim sends register moves and zeroing idioms through the ALU
+// instead of resolving them at rename.
+// --fuse picks the adjacent pairs issued as one macro-op: all (default),
+// none, or some of lui (lui+addi), call (auipc+jalr), shadd (slli+add)
+// and branch (slt*+beqz/bnez), comma-separated.
+// --stats prints "<name> <value>" lines to stderr after the run, with an
+// energy estimate from the counted structure accesses; --energy replaces
+// the default pJ per event with "<name> <pJ>" lines (see energy.h).
+// --cosim checks every retired instruction against the functional core.
+// --cores runs N cores over the shared memory, one host thread each, kept
+// within Q cycles of each other (default 1000); hart h starts with a0 = h
+// and hart 0's result is printed.
+// --rs/--lb/--rob size the reservation stations (default 6), load buffer
+// (3) and reorder buffer (32, a power of two), up to 256 each; --prf sets
+// the physical registers shared by x0..x31 and in-flight results (default
+// 32 + rob, which never stalls rename).
+// --loop-buffer sets the loop buffer entries in front of fetch (default 32,
+// at most 64, 0 turns it off).
+// --ftq sets the fetch blocks the branch predictor may run ahead of fetch
+// (default 4, a power of two up to 32).
+// --miss-latency puts a 16 KiB data cache in front of memory whose misses
+// cost N more cycles (default 0: no cache, every load takes 3 cycles).
+// --prefetch picks its prefetchers: all (default), none, or some of stride
+// (per load PC) and stream (next lines), comma-separated; each trigger asks
+// for --prefetch-degree lines (default 2) and at most --prefetch-mshr
+// prefetches (default 4, up to 16) are in flight. --stats then reports
+// prefetch coverage, accuracy and timeliness.
+// --value-predict lets loads whose value the predictor is confident about
+// (--value-confidence, 0..7, default 5) hand their consumers the last value
+// (or last value plus stride) at issue; a wrong guess refetches everything
+// after the load when it retires. --stats reports coverage and accuracy.
+// --trace writes a Konata pipeline timeline (hart h > 0: file.kanata.h).
+// --depgraph writes the dependency graph of the retired instructions, one
+// line each, for critpath to find the critical path in (hart h > 0:
+// file.dep.h).
+// --intervals writes a CSV row per N cycles (--interval, default 10000) or
+// N committed instructions (--interval-insts) with that interval's IPC,
+// mispredict rate, ROB/RS/LB occupancy, flushes, front-end bubbles, back-end
+// stalls, FTQ occupancy and energy (hart h > 0: file.csv.h).
+// --profile writes per-function/block/PC hotspots to prefix.txt and call
+// stacks for flamegraph.pl to prefix.folded; --symbols names functions
+// from `nm` output.
+// --batch runs N instances of the program functionally, instance i with
+// a0 = i, eight at a time in SIMD lockstep, and prints each one's result;
+// --batch-args takes the instances' initial a0..a7 from a file instead,
+// one line each.
+// --fork-config sweeps core settings without repeating the start of the
+// program: it is run once functionally for --fork-at instructions (default
+// 0), then one forked child per --fork-config applies those arguments and
+// simulates the rest in detail. The children's results and stats are
+// printed as one table on stdout. Config k > 0 writes the --trace,
+// --depgraph, --intervals and --profile outputs it inherits to file.k.
+int main(int argc, char *argv[]) {
+    Options opts;
+    if (!ParseArgs(argc, argv, 1, opts) || !CheckArgs(opts)) return 1;
+    if (opts.data && !freopen(opts.data, "r", stdin)) {
+        std::cerr << "cannot open " << opts.data << '\n';
+        return 1;
+    }
 
     Simulator::Read();
-    Simulator::Run();
+    auto begin = std::chrono::steady_clock::now();
+    if (!opts.batch.empty()) {
+        BatchEngine<size> engine(memory);
+        for (u_int32_t result: engine.Run(opts.batch)) std::cout << std::dec << result << '\n';
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+        if (opts.report) engine.Report(std::cerr, opts.batch.size(), seconds);
+        return 0;
+    }
+    if (opts.jit) {
+        JitEngine<size> engine(memory);
+        engine.Run();
+        std::cout << std::dec << engine.Result() << '\n';
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+        if (opts.report) engine.Report(std::cerr, seconds);
+        return 0;
+    }
+    if (!opts.configs.empty()) return ForkServer(opts);
+    if (opts.check) cosim.Enable(memory);
+    Simulator::Run(opts.seed, opts.skipIdle, opts.harts, opts.quantum);
+    double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+    if (opts.report) Simulator::Report(std::cerr, seconds);
     return 0;
 }
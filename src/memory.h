@@ -34,6 +34,8 @@ public:
         mem[addr + 3] = input >> 24 & 255;
     }
 
+    byte *data() { return mem; }
+
     byte readByte(addr_t addr) {
         return mem[addr];
     }
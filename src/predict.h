@@ -22,9 +22,7 @@ private:
     }
 
 public:
-    TwoLevelPredictor() {
-        total_ = correct_ = 0;
-        memset(GHR, 0, sizeof(GHR));
+    constexpr TwoLevelPredictor() : GHR(), PHT(), total_(0), correct_(0) {
         for (int i = 0; i < 7; ++i) {
             for (int j = 0; j < size; ++j) {
                 PHT[i][j] = 1;
@@ -0,0 +1,220 @@
+#ifndef RISC_V_PROFILE_H
+#define RISC_V_PROFILE_H
+
+#include <algorithm>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "decode.h"
+#include "memory.h"
+#include "utils.h"
+
+// Guest hotspot profiler. The core reports retirements, the PC at the ROB
+// head every cycle, mispredicts and load latencies; they are kept per PC
+// and rolled up into basic blocks and functions at the end:
+//   <prefix>.txt     functions, blocks and PCs sorted by cycles
+//   <prefix>.folded  call stacks with their cycles, for flamegraph.pl
+// Functions come from a symbol map ("addr [type] name" lines as printed by
+// nm) when given, otherwise from the call targets seen at run time.
+class HotspotProfiler {
+public:
+    struct PcStats {
+        u_int64_t retired = 0;
+        u_int64_t cycles = 0;      // cycles spent as ROB head
+        u_int64_t mispredicts = 0;
+        u_int64_t loads = 0;
+        u_int64_t loadCycles = 0;  // issue to result broadcast
+        u_int32_t order = 0;
+    };
+
+private:
+    struct Node { // call tree: one node per distinct call stack
+        u_int32_t func;
+        int parent;
+        u_int64_t cycles = 0;
+        std::map<u_int32_t, int> child;
+
+        Node(u_int32_t f, int p) : func(f), parent(p) {}
+    };
+
+    static const u_int32_t kNone = ~0u;
+
+    std::unordered_map<u_int32_t, PcStats> pcs_;
+    std::map<u_int32_t, std::string> symbols_;
+    std::vector<u_int32_t> leaders_;  // block starts seen at run time
+    std::vector<u_int32_t> callees_;  // call targets seen at run time
+    std::vector<Node> tree_;
+    int node_ = 0;                    // current call stack
+    u_int64_t emptyCycles_ = 0;       // cycles with nothing in the ROB
+    u_int32_t last_ = kNone;          // previous retired PC
+    bool control_ = true;             // previous retirement was a control transfer
+    bool call_ = false, ret_ = false;
+
+public:
+    HotspotProfiler() { tree_.emplace_back(0, -1); }
+
+    bool LoadSymbols(const std::string &path) {
+        std::ifstream in(path);
+        if (!in) return false;
+        std::string line;
+        while (std::getline(in, line)) {
+            std::istringstream fields(line);
+            std::string addr, type, name;
+            if (!(fields >> addr >> type)) continue;
+            if (!(fields >> name)) name = type, type = "T";
+            if (type != "T" && type != "t") continue;
+            symbols_[std::stoul(addr, nullptr, 16)] = name;
+        }
+        return true;
+    }
+
+    // One ROB head retired.
+    void Retire(u_int32_t pc, u_int32_t order) {
+        if (call_) {
+            callees_.push_back(pc);
+            Enter(Function(pc));
+        } else if (ret_ && tree_[node_].parent >= 0) {
+            node_ = tree_[node_].parent;
+        }
+        if (control_ || pc != last_ + 4) leaders_.push_back(pc);
+        PcStats &s = pcs_[pc];
+        ++s.retired;
+        s.order = order;
+        Decode decoder;
+        decoder.SetOrder(order);
+        decoder.decode();
+        bool link = decoder.rd_ == 1 || decoder.rd_ == 5;
+        call_ = (decoder.type_ == 'J' || decoder.op_ == JALR) && link;
+        ret_ = decoder.op_ == JALR && !link && (decoder.rs1_ == 1 || decoder.rs1_ == 5);
+        control_ = decoder.type_ == 'J' || decoder.type_ == 'B' || decoder.op_ == JALR;
+        last_ = pc;
+    }
+
+    // n cycles in which pc sat at the ROB head (kNone: the ROB was empty).
+    void Cycles(u_int32_t pc, int n) {
+        tree_[node_].cycles += n;
+        if (pc == kNone) emptyCycles_ += n;
+        else pcs_[pc].cycles += n;
+    }
+
+    static u_int32_t Empty() { return kNone; }
+
+    void Mispredict(u_int32_t pc) { ++pcs_[pc].mispredicts; }
+
+    void Load(u_int32_t pc, int cycles) {
+        PcStats &s = pcs_[pc];
+        ++s.loads;
+        s.loadCycles += cycles;
+    }
+
+    bool Write(const std::string &prefix) {
+        std::sort(leaders_.begin(), leaders_.end());
+        leaders_.erase(std::unique(leaders_.begin(), leaders_.end()), leaders_.end());
+        std::sort(callees_.begin(), callees_.end());
+        callees_.erase(std::unique(callees_.begin(), callees_.end()), callees_.end());
+
+        std::map<u_int32_t, PcStats> blocks, funcs;
+        u_int64_t total = emptyCycles_;
+        for (auto &p: pcs_) {
+            total += p.second.cycles;
+            Add(blocks[Floor(leaders_, p.first)], p.second);
+            Add(funcs[Function(p.first)], p.second);
+        }
+        std::ofstream out(prefix + ".txt");
+        if (!out) return false;
+        out << "cycles " << total << "  (rob empty " << emptyCycles_ << ")\n";
+        Section(out, "functions", funcs, total, false);
+        Section(out, "basic blocks", blocks, total, false);
+        std::map<u_int32_t, PcStats> pcs(pcs_.begin(), pcs_.end());
+        Section(out, "instructions", pcs, total, true);
+
+        std::ofstream folded(prefix + ".folded");
+        if (!folded) return false;
+        for (int i = 0; i < (int) tree_.size(); ++i) {
+            if (!tree_[i].cycles) continue;
+            std::string stack;
+            for (int n = i; n >= 0; n = tree_[n].parent) stack = Name(tree_[n].func) + (stack.empty() ? "" : ";") + stack;
+            folded << stack << ' ' << tree_[i].cycles << '\n';
+        }
+        return true;
+    }
+
+private:
+    void Enter(u_int32_t func) {
+        auto it = tree_[node_].child.find(func);
+        if (it != tree_[node_].child.end()) {
+            node_ = it->second;
+            return;
+        }
+        tree_.emplace_back(func, node_);
+        tree_[node_].child[func] = tree_.size() - 1;
+        node_ = tree_.size() - 1;
+    }
+
+    static u_int32_t Floor(const std::vector<u_int32_t> &starts, u_int32_t pc) {
+        auto it = std::upper_bound(starts.begin(), starts.end(), pc);
+        return it == starts.begin() ? 0 : *--it;
+    }
+
+    u_int32_t Function(u_int32_t pc) const {
+        if (!symbols_.empty()) {
+            auto it = symbols_.upper_bound(pc);
+            return it == symbols_.begin() ? 0 : (--it)->first;
+        }
+        return Floor(callees_, pc);
+    }
+
+    std::string Name(u_int32_t addr) const {
+        auto it = symbols_.find(addr);
+        if (it != symbols_.end()) return it->second;
+        std::ostringstream name;
+        name << "0x" << std::hex << std::setw(8) << std::setfill('0') << addr;
+        return name.str();
+    }
+
+    static void Add(PcStats &to, const PcStats &from) {
+        to.retired += from.retired;
+        to.cycles += from.cycles;
+        to.mispredicts += from.mispredicts;
+        to.loads += from.loads;
+        to.loadCycles += from.loadCycles;
+    }
+
+    void Section(std::ostream &out, const char *title, const std::map<u_int32_t, PcStats> &rows,
+                 u_int64_t total, bool disasm) const {
+        std::vector<std::pair<u_int32_t, PcStats>> sorted(rows.begin(), rows.end());
+        std::stable_sort(sorted.begin(), sorted.end(), [](const std::pair<u_int32_t, PcStats> &a,
+                                                          const std::pair<u_int32_t, PcStats> &b) {
+            return a.second.cycles > b.second.cycles;
+        });
+        out << '\n' << title << '\n' << std::left << std::setw(24) << "where" << std::right
+            << std::setw(12) << "cycles" << std::setw(8) << "%" << std::setw(12) << "retired"
+            << std::setw(8) << "CPI" << std::setw(10) << "mispred" << std::setw(10) << "ld lat" << '\n';
+        for (auto &row: sorted) {
+            const PcStats &s = row.second;
+            std::string where = Name(row.first);
+            if (disasm) {
+                Decode decoder;
+                u_int32_t order = s.order;
+                decoder.SetOrder(order);
+                decoder.decode();
+                where += std::string(" ") + kOrderName[decoder.op_];
+            }
+            out << std::left << std::setw(24) << where << std::right << std::fixed << std::setprecision(2)
+                << std::setw(12) << s.cycles << std::setw(8) << (total ? 100.0 * s.cycles / total : 0.0)
+                << std::setw(12) << s.retired << std::setw(8) << (s.retired ? 1.0 * s.cycles / s.retired : 0.0)
+                << std::setw(10) << s.mispredicts
+                << std::setw(10) << (s.loads ? 1.0 * s.loadCycles / s.loads : 0.0) << '\n';
+        }
+    }
+};
+
+std::string ProfilePath, SymbolPath;              // --profile / --symbols
+thread_local HotspotProfiler *profiler = nullptr; // this thread's core, when profiling
+
+#endif //RISC_V_PROFILE_H
@@ -2,22 +2,76 @@
 #define RISC_V_SIMULATOR_H
 
 #include <algorithm>
+#include <climits>
+#include <condition_variable>
 #include <iomanip>
 #include <iostream>
 #include <random>
 #include <sstream>
+#include <thread>
 #include <vector>
 #include "alu.h"
+#include "cache.h"
+#include "coherence.h"
+#include "cosim.h"
 #include "decode.h"
+#include "depgraph.h"
+#include "hostprof.h"
+#include "interval.h"
+#include "loop.h"
 #include "memory.h"
 #include "predict.h"
+#include "profile.h"
+#include "stats.h"
+#include "trace.h"
 #include "utils.h"
+#include "value.h"
 
 const int size = 0x1000000;
-int Clock = 0;
 Memory<size> memory;
-TwoLevelPredictor predictor;
-u_int32_t PC = 0;
+CoherentMemory<size> shared(memory);
+CoSimChecker<size> cosim;
+
+// Architectural state hart 0 starts from instead of pc 0 and zeroed
+// registers, when the program was fast-forwarded (--fork-at).
+struct WarmStart {
+    bool valid = false;
+    u_int32_t pc = 0;
+    u_int32_t reg[32] = {};
+} warmStart;
+
+// Everything below is per core: each core is simulated on its own host
+// thread and sees its own copy.
+thread_local int Hart = 0;
+thread_local int Clock = 0;
+thread_local TwoLevelPredictor predictor;
+thread_local u_int32_t PC = 0;
+thread_local bool Halted = false;
+bool Eliminate = true; // resolve moves and zeroing idioms at rename (--no-elim)
+
+// Adjacent instruction pairs issued as one macro-op (--fuse).
+enum FusionKind {
+    kFuseLui = 1,       // lui rd + addi rd, rd: one constant
+    kFuseCall = 2,      // auipc rd + jalr rd, rd: target known at issue
+    kFuseShiftAdd = 4,  // slli rd, 1..3 + add rd, rd: sh1add..sh3add
+    kFuseBranch = 8,    // slt* rd + beqz/bnez rd: compare and branch in one station
+    kFuseAll = 15
+};
+int Fusion = kFuseAll;
+
+// Window sizes of the out-of-order core (--rs, --lb, --rob), shared by all cores.
+struct WindowConfig {
+    static const int kMaxStations = 256;
+    static const int kMaxRob = 256;
+    static const int kMaxPhys = kMaxRob + 32;
+    int rs = 6;
+    int lb = 3;
+    int rob = 32; // a power of two
+    int prf = 0;  // physical registers; 0: 32 + rob, which never runs out
+
+    int Physical() const { return prf ? prf : 32 + rob; }
+    int Entries() const { return rs + lb + rob + Physical(); } // what leaks every cycle
+} window;
 
 enum State {
     empty, waitingCDB, executed,
@@ -28,20 +82,25 @@ struct instruction_queue {
     u_int32_t pc = 0;
     u_int32_t order = 0;
     bool jump = false;
+    u_int64_t seq = 0; // fetch sequence number (trace, dependency graph)
+    Decode decoded;    // of order, done once at fetch
 };
 
 struct InstructionQueue {
 public:
     bool stall_ = false;
     bool end_ = false;
+    u_int64_t fetched_ = 0; // sequence numbers when not tracing
     Queue<instruction_queue> buffer_;
 
     bool ifEmpty() { return buffer_.ifEmpty(); }
 
     bool ifFull() { return buffer_.ifFull(); }
 
-    void enQueue(u_int32_t pc, u_int32_t order, bool jump = false) {
-        buffer_.enQueue((instruction_queue) {pc, order, jump});
+    void enQueue(u_int32_t pc, const Decode &decoded, bool jump = false) {
+        u_int64_t seq = tracer ? tracer->Fetch(pc, decoded.order_) : fetched_++;
+        if (depGraph) depGraph->Fetch(seq);
+        buffer_.enQueue((instruction_queue) {pc, decoded.order_, jump, seq, decoded});
     }
 
     void deQueue() { buffer_.deQueue(); }
@@ -49,29 +108,221 @@ public:
     void Flush() {
         stall_ = false;
         end_ = false;
+        if (tracer) {
+            for (int i = 0; i < buffer_.len; ++i) tracer->Squash(buffer_[i].seq);
+        }
+        buffer_.clear();
+    }
+
+};
+
+thread_local InstructionQueue isq;
+
+int FtqSize = 4; // --ftq, fetch blocks between predictor and fetch
+
+// Fetch target queue: the branch predictor runs ahead of fetch and leaves
+// predicted fetch blocks here. Each cycle it predecodes up to kBlock
+// instructions from its own PC and ends the block after a jump, a branch
+// predicted taken, a JALR (it has no indirect target, so it stops until
+// redirected) or the end marker. Fetch takes instructions off the head
+// block in order. A redirect empties the queue and lets the predictor run
+// again in the same cycle, so fetch restarts without a bubble. Histories
+// are only updated at commit, so the further ahead it runs, the staler the
+// history it predicts with.
+class FetchTargetQueue {
+public:
+    static const int kMaxBlocks = 32;
+    static const int kBlock = 8;
+
+    struct Block {
+        u_int32_t start = 0;
+        u_int32_t next = 0; // where fetch goes after the last instruction
+        int count = 0;
+        bool taken = false; // the last instruction is a branch predicted taken
+    };
+
+    Queue<Block, kMaxBlocks> buffer_;
+
+private:
+    u_int32_t pc_ = 0;     // start of the next block
+    bool stopped_ = false; // at a JALR or the end marker
+    int predicted_ = -1;   // Clock of the last block, one per cycle
+    int fetched_ = 0;      // instructions of the head block already fetched
+    int noted_ = -1;       // Clock of the last bubble or stall counted
+
+public:
+    void Resize(int n) {
+        buffer_.Resize(n);
+        Redirect(0);
+        noted_ = -1;
+    }
+
+    // Fetch goes on at pc: the predicted path is thrown away.
+    void Redirect(u_int32_t pc) {
         buffer_.clear();
+        pc_ = pc;
+        stopped_ = false;
+        predicted_ = -1;
+        fetched_ = 0;
     }
 
-} isq;
+    // Fetch met a JALR: nothing can be predicted until its target is known.
+    void Stop() {
+        buffer_.clear();
+        stopped_ = true;
+        fetched_ = 0;
+    }
+
+    // True if the predictor would add a block this cycle.
+    bool Busy() { return !stopped_ && !buffer_.ifFull(); }
+
+    // True if the predictor stopped but fetch found no JALR or end there
+    // (the code changed underneath it).
+    bool Stranded() { return stopped_ && buffer_.ifEmpty(); }
+
+    void Predict(int clock) {
+        if (predicted_ == clock || !Busy()) return;
+        predicted_ = clock;
+        Block b;
+        b.start = pc_;
+        for (u_int32_t pc = pc_;; pc += 4) {
+            u_int32_t order = memory.readWord(pc);
+            const DecodeEntry &e = Decode::Entry(order);
+            ++b.count;
+            b.next = pc + 4;
+            if (order == 0x0ff00513 || e.op == JALR) {
+                stopped_ = true;
+                break;
+            }
+            if (e.type == 'J') {
+                b.next = pc + Decode::Immediate(order, e.imm);
+                break;
+            }
+            if (e.type == 'B') {
+                ++stats.activity[kEnPredictLookup];
+                if (predictor.Predict(pc)) {
+                    b.taken = true;
+                    b.next = pc + Decode::Immediate(order, e.imm);
+                    break;
+                }
+            }
+            if (b.count == kBlock) break;
+        }
+        pc_ = b.next;
+        buffer_.enQueue(b);
+        ++stats.ftqBlocks;
+    }
+
+    // Takes the next instruction to fetch: its pc, the predicted pc after it
+    // and whether it is a branch predicted taken; false if there is none.
+    bool Next(u_int32_t &pc, u_int32_t &next, bool &taken) {
+        if (buffer_.ifEmpty()) return false;
+        Block &b = buffer_[0];
+        pc = b.start + 4 * fetched_;
+        bool last = ++fetched_ == b.count;
+        next = last ? b.next : pc + 4;
+        taken = last && b.taken;
+        if (last) buffer_.deQueue(), fetched_ = 0;
+        return true;
+    }
+
+    // Counts a cycle in which fetch was held up, once per cycle.
+    void Note(u_int64_t &counter, int clock) {
+        if (noted_ != clock) ++counter, noted_ = clock;
+    }
+};
+
+thread_local FetchTargetQueue ftq;
 
 struct CommonDataBus {
     int entry = 0; // ROB entry tag
+    int preg = 0;  // physical destination, 0 if none
     u_int32_t result = 0;
-} cdb;
-
-struct reg_file {
-    int entry = 0; // ROB entry tag
-    u_int32_t val = 0;
 };
 
-class RegFile { // RegFile / FP registers
+thread_local CommonDataBus cdb;
+
+// Unified physical register file. Destinations are renamed at issue onto a
+// register taken from the free list (map_); retire_ is the mapping as of the
+// last retired instruction, which commit advances and a mispredict restores.
+// Physical register 0 is x0: never renamed, always ready and zero.
+// Eliminated moves map several architectural registers onto one physical
+// register, so registers are reference counted: refs_ counts the retire_
+// entries and in-flight ROB entries holding each one.
+class RegFile {
 public:
-    reg_file Reg_[32];
+    static const int kMax = WindowConfig::kMaxPhys;
+    int num_ = 64;
+    u_int32_t val_[kMax];
+    bool ready_[kMax];
+    int refs_[kMax];
+    int map_[32];
+    int retire_[32];
+    TagStack<kMax> free_;
+    int peak_ = 32; // most physical registers in use at once
 
-    void Flush() {
-        for (auto &i: Reg_) { i.entry = 0; }
+    constexpr RegFile() : val_(), ready_(), refs_(), map_(), retire_(), free_() {
+        for (int r = 0; r < 32; ++r) map_[r] = retire_[r] = r, ready_[r] = true, refs_[r] = 1;
+        for (int p = num_ - 1; p >= 32; --p) free_.push_back(p);
+    }
+
+    // Empties the machine: x1..x31 on physical 1..31, all zero.
+    void Resize(int num) {
+        num_ = num;
+        for (int p = 0; p < num_; ++p) val_[p] = 0, ready_[p] = true;
+        for (int r = 0; r < 32; ++r) map_[r] = retire_[r] = r;
+        Recover();
+        peak_ = 32;
+    }
+
+    bool ifFull() const { return free_.empty(); }
+
+    // Maps rd onto a fresh physical register and returns it; `old` receives
+    // the one it replaces, to be freed when this instruction retires.
+    int Rename(int rd, int &old) {
+        int p = free_.back();
+        free_.pop_back();
+        old = map_[rd];
+        map_[rd] = p;
+        ready_[p] = false;
+        refs_[p] = 1;
+        peak_ = std::max(peak_, num_ - free_.count());
+        return p;
     }
-} rf;
+
+    // Points rd at the physical register of rs (a move, or with rs = x0 a
+    // zeroing idiom) and returns it; `old` as for Rename.
+    int Share(int rd, int rs, int &old) {
+        int p = map_[rs];
+        old = map_[rd];
+        map_[rd] = p;
+        ++refs_[p];
+        return p;
+    }
+
+    void Write(int p, u_int32_t val) {
+        val_[p] = val;
+        ready_[p] = true;
+    }
+
+    void Retire(int rd, int p, int old) {
+        retire_[rd] = p;
+        if (old && !--refs_[old]) free_.push_back(old);
+    }
+
+    // Architectural value of x[r].
+    u_int32_t Arch(int r) const { return val_[retire_[r]]; }
+
+    // Drops every rename younger than the last retirement.
+    void Recover() {
+        for (int p = 0; p < num_; ++p) refs_[p] = 0;
+        for (int r = 0; r < 32; ++r) map_[r] = retire_[r], ++refs_[retire_[r]];
+        free_.clear();
+        for (int p = num_ - 1; p > 0; --p) if (!refs_[p]) free_.push_back(p);
+    }
+};
+
+thread_local RegFile rf;
 
 struct reorder_buffer {
     char type = 0; // A、L、S、B
@@ -79,31 +330,57 @@ struct reorder_buffer {
     int entry = 0;
     u_int32_t order = 0;
     u_int32_t dest = 0; // reg->A、L, Addr->S, Nope->B
-    u_int32_t val = 0; // regVal, StoreData
+    int preg = 0; // physical register renamed onto dest
+    int old = 0; // physical register dest was mapped to before
+    bool eliminated = false; // move or zeroing idiom resolved at rename
+    int fuse = 0; // FusionKind when this entry stands for two instructions
+    u_int32_t order2 = 0; // the second one, at pc_now_ + 4
+    u_int32_t val = 0; // branch outcome, StoreData; register results live in rf
     bool jump = false;
     u_int32_t pc_now_ = 0;
     u_int32_t pc_des_ = 0;
+    u_int64_t seq = 0; // fetch sequence number
+    bool predicted = false; // load whose value was predicted at issue
+    bool replay = false;    // ... wrongly: what follows it is refetched
 };
 
 class ReorderBuffer { // Reorder Buffer
 public:
     int entry_num_ = 1;
-    Queue<reorder_buffer> buffer_;
+    Queue<reorder_buffer, WindowConfig::kMaxRob> buffer_;
 
     bool ifEmpty() { return buffer_.ifEmpty(); }
 
     bool ifFull() { return buffer_.ifFull(); }
 
-    void deQueue() { buffer_.deQueue(); }
+    void deQueue() {
+        reorder_buffer &head = buffer_[0];
+        if (tracer) tracer->Retire(head.seq);
+        if (depGraph) depGraph->Retire(head.seq, head.pc_now_, head.eliminated ? 'E' : head.type, head.fuse ? 2 : 1);
+        buffer_.deQueue();
+    }
 
     int NewEntry() const { return entry_num_; }
 
+    // Buffer slot of ROB entry tag `entry`; at most one live entry per slot.
+    int Slot(int entry) const { return (entry - 1) & (buffer_.cap - 1); }
+
     void Flush() {
+        if (tracer) {
+            for (int i = 0; i < buffer_.len; ++i) tracer->Squash(buffer_[i].seq);
+        }
         entry_num_ = 1;
         buffer_.clear();
     }
 
-    void Issue(Decode &decoder, u_int32_t pc_now, u_int32_t pc_des = 0, bool jump = false) {
+    // Stage transition of ROB entry `entry` in the pipeline trace and the
+    // dependency graph.
+    void Trace(int entry, const char *stage) {
+        if (tracer) tracer->Stage(buffer_.getVal(entry).seq, stage);
+        if (depGraph) depGraph->Stage(buffer_.getVal(entry).seq, stage);
+    }
+
+    void Issue(const Decode &decoder, u_int32_t pc_now, u_int32_t pc_des = 0, bool jump = false) {
         reorder_buffer tmp;
         tmp.type = decoder.type_;
         tmp.order = decoder.order_;
@@ -114,43 +391,63 @@ public:
             tmp.dest = decoder.rd_;
             tmp.entry = NewEntry();
             ++entry_num_;
-            if (tmp.dest) { // 非F0
-                rf.Reg_[tmp.dest].entry = tmp.entry;
-            }
+            if (tmp.dest) tmp.preg = rf.Rename(tmp.dest, tmp.old); // 非F0
         } else {
             tmp.entry = NewEntry();
             ++entry_num_;
         }
         buffer_.enQueue(tmp);
+        ++stats.activity[kEnRobWrite];
     }
 
     void Reception() {
-        buffer_.getVal(cdb.entry).ready = true;
-        buffer_.getVal(cdb.entry).val = cdb.result;
+        ++stats.activity[kEnRobWrite];
+        reorder_buffer &e = buffer_.getVal(cdb.entry);
+        e.ready = true;
+        if (cdb.preg) {
+            if (e.predicted && rf.val_[cdb.preg] != cdb.result) e.replay = true; // consumers ran on a wrong value
+            rf.Write(cdb.preg, cdb.result);
+        } else e.val = cdb.result;
     }
-} rob;
-
-struct reservation_station {
-    State state = empty;
-    RV32I_Order op = NOPE;
-    int entry = 0; // ROB entry tag
-    u_int32_t Qj = 0, Qk = 0;
-    u_int32_t Vj = 0, Vk = 0;
-    u_int32_t result = 0;
 
-    bool Ready() const {
-        return !(Qj || Qk);
-    }
+    // Destination register of ROB entry `entry`, 0 if none.
+    int Preg(int entry) { return buffer_.getVal(entry).preg; }
 };
 
+thread_local ReorderBuffer rob;
+
+// Stations are kept as structure of arrays indexed by station tag. Instead
+// of scanning every entry each cycle, they keep bit sets of the entries that
+// are ready to execute and ready to broadcast, and one bit set per physical
+// register of the entries waiting on it (waitJ_/waitK_), so a CDB broadcast
+// only touches its consumers. Selection takes the lowest tag, as the scans
+// did.
+using StationSet = BitSet<WindowConfig::kMaxStations>;
+
 class ReservationStation { // Reservation Stations
 public:
-    static const int kNum = 6;
-    reservation_station sta_[kNum];
-    std::vector<int> idx_;
+    static const int kMax = WindowConfig::kMaxStations;
+    int num_ = 6;
+    State state_[kMax];
+    RV32I_Order op_[kMax];
+    int entry_[kMax]; // ROB entry tag
+    u_int32_t Qj_[kMax], Qk_[kMax];
+    u_int32_t Vj_[kMax], Vk_[kMax];
+    u_int32_t result_[kMax];
+    StationSet ready_;    // waitingCDB with both operands
+    StationSet executed_;
+    StationSet waitJ_[WindowConfig::kMaxPhys], waitK_[WindowConfig::kMaxPhys];
+    TagStack<kMax> idx_;
 
-    ReservationStation() {
-        for (int i = kNum - 1; i >= 0; --i) idx_.push_back(i);
+    constexpr ReservationStation() : state_(), op_(), entry_(), Qj_(), Qk_(), Vj_(), Vk_(), result_(),
+                                     ready_(), executed_(), waitJ_(), waitK_(), idx_() {
+        for (int i = num_ - 1; i >= 0; --i) idx_.push_back(i);
+    }
+
+    void Resize(int num) {
+        Flush();
+        num_ = num;
+        Flush();
     }
 
     bool ifFull() const { return idx_.empty(); }
@@ -165,96 +462,114 @@ public:
 
     void Flush() {
         idx_.clear();
-        reservation_station tmp;
-        for (int i = kNum - 1; i >= 0; --i) {
+        for (int i = num_ - 1; i >= 0; --i) {
             idx_.push_back(i);
-            sta_[i] = tmp;
+            if (state_[i] == waitingCDB) {
+                waitJ_[Qj_[i]].reset(i);
+                waitK_[Qk_[i]].reset(i);
+            }
+            state_[i] = empty;
+            Qj_[i] = Qk_[i] = 0;
         }
+        ready_.clear();
+        executed_.clear();
     }
 
-    void Issue(int entry, Decode &decoder) { // B、I、R
+    void Issue(int entry, const Decode &decoder) { // B、I、R
+        ++stats.activity[kEnRsWrite];
         int tag = AssignTag();
-        sta_[tag].state = waitingCDB;
-        sta_[tag].op = decoder.op_;
-        sta_[tag].entry = entry;
-        int rs1 = decoder.rs1_, e = rf.Reg_[rs1].entry;
-        if (e) {
-            if (rob.buffer_.getVal(e).ready) sta_[tag].Vj = rob.buffer_.getVal(e).val;
-            else sta_[tag].Qj = e;
-        } else sta_[tag].Vj = rf.Reg_[rs1].val;
+        state_[tag] = waitingCDB;
+        op_[tag] = decoder.op_;
+        entry_[tag] = entry;
+        Qj_[tag] = Qk_[tag] = 0;
+        int p = rf.map_[decoder.rs1_];
+        if (rf.ready_[p]) Vj_[tag] = rf.val_[p];
+        else Qj_[tag] = p, waitJ_[p].set(tag);
         if (decoder.type_ == 'I') {
-            sta_[tag].Vk = decoder.imm_;
-            sta_[tag].Qk = 0;
+            Vk_[tag] = decoder.imm_;
         } else {
-            int rs2 = decoder.rs2_;
-            e = rf.Reg_[rs2].entry;
-            if (e) {
-                if (rob.buffer_.getVal(e).ready) sta_[tag].Vk = rob.buffer_.getVal(e).val;
-                else sta_[tag].Qk = e;
-            } else sta_[tag].Vk = rf.Reg_[rs2].val;
+            p = rf.map_[decoder.rs2_];
+            if (rf.ready_[p]) Vk_[tag] = rf.val_[p];
+            else Qk_[tag] = p, waitK_[p].set(tag);
         }
+        if (!Qj_[tag] && !Qk_[tag]) ready_.set(tag);
     }
 
+    // True if Execute/Broadcast would do nothing this cycle.
+    bool Idle() const { return !ready_.any() && !executed_.any(); }
+
     void Execute() {
+        HOST_SCOPE(kHostRsSelect);
+        int i = ready_.next(0);
+        if (i < 0) return;
         ALU alu;
-        for (auto &i: sta_) {
-            if (i.state == waitingCDB && i.Ready()) {
-                i.result = alu.calc(i.op, i.Vj, i.Vk);
-                i.state = executed;
-                if (i.op == JALR) {
-                    u_int32_t tmp = PC;
-                    PC = i.result;
-                    i.result = tmp + 4;
-                    isq.stall_ = false;
-                }
-                break;
-            }
+        ready_.reset(i);
+        ++stats.activity[kEnAluOp];
+        result_[i] = alu.calc(op_[i], Vj_[i], Vk_[i]);
+        state_[i] = executed;
+        executed_.set(i);
+        rob.Trace(entry_[i], "X");
+        if (op_[i] == JALR) {
+            u_int32_t tmp = PC;
+            PC = result_[i] & (size - 4); // a mispredicted load value can send it anywhere
+            result_[i] = tmp + 4;
+            isq.stall_ = false;
+            ftq.Redirect(PC);
+            if (depGraph) depGraph->Redirect(rob.buffer_.getVal(entry_[i]).seq, 'j');
         }
     }
 
     bool Broadcast() {
-        for (int i = 0; i < kNum; ++i) {
-            if (sta_[i].state == executed) {
-                cdb = (CommonDataBus) {sta_[i].entry, sta_[i].result};
-                sta_[i].state = empty;
-                RestoreTag(i);
-                return true;
-            }
-        }
-        return false;
+        int i = executed_.next(0);
+        if (i < 0) return false;
+        rob.Trace(entry_[i], "Wb");
+        cdb = (CommonDataBus) {entry_[i], rob.Preg(entry_[i]), result_[i]};
+        state_[i] = empty;
+        executed_.reset(i);
+        RestoreTag(i);
+        return true;
     }
 
     void Reception() {
-        for (auto &i: sta_) {
-            if (i.state == waitingCDB) {
-                if (i.Qj == cdb.entry) i.Qj = 0, i.Vj = cdb.result;
-                else if (i.Qk == cdb.entry) i.Qk = 0, i.Vk = cdb.result;
-            }
+        StationSet &j = waitJ_[cdb.preg], &k = waitK_[cdb.preg];
+        stats.activity[kEnRsCompare] += num_;
+        for (int i = j.next(0); i >= 0; i = j.next(i + 1)) {
+            Qj_[i] = 0, Vj_[i] = cdb.result;
+            if (!Qk_[i]) ready_.set(i);
+            ++stats.activity[kEnRsWrite];
         }
-    }
-} rs;
-
-struct load_buffer {
-    State state = empty;
-    RV32I_Order op = NOPE;
-    char type = 0;
-    int entry = 0; // ROB entry tag
-    u_int32_t Qj = 0, Qk = 0;
-    u_int32_t Vj = 0, Vk = 0;
-    u_int32_t StoreAddr = 0;
-    u_int32_t StoreData = 0;
-    int time = 0;
-
-    bool Ready() const {
-        return !(Qj || Qk);
+        for (int i = k.next(0); i >= 0; i = k.next(i + 1)) {
+            Qk_[i] = 0, Vk_[i] = cdb.result;
+            if (!Qj_[i]) ready_.set(i);
+            ++stats.activity[kEnRsWrite];
+        }
+        j.clear();
+        k.clear();
     }
 };
 
+thread_local ReservationStation rs;
+
 class LoadBuffer { // Load Buffers
-    static const int kNum = 3;
 public:
-    load_buffer sta_[kNum];
-    std::vector<int> idx_;
+    static const int kMax = WindowConfig::kMaxStations;
+    int num_ = 3;
+    State state_[kMax];
+    RV32I_Order op_[kMax];
+    char type_[kMax];
+    int entry_[kMax]; // ROB entry tag
+    u_int32_t Qj_[kMax], Qk_[kMax];
+    u_int32_t Vj_[kMax], Vk_[kMax];
+    u_int32_t StoreAddr_[kMax];
+    u_int32_t StoreData_[kMax];
+    int time_[kMax];
+    StationSet ready_;    // waitingCDB with both operands
+    StationSet executed_;
+    StationSet getAddr_;  // loads with their address, not yet sent to memory
+    StationSet stores_;   // busy S and A entries, for disambiguation
+    StationSet waitJ_[WindowConfig::kMaxPhys], waitK_[WindowConfig::kMaxPhys];
+    int slot_[WindowConfig::kMaxRob]; // station tag of each S/A entry by ROB slot
+    TagStack<kMax> idx_;
 
     struct load_clock {
         int tag = 0;
@@ -265,8 +580,16 @@ public:
         int time = 0;
     } storeClock_;
 
-    LoadBuffer() {
-        for (int i = kNum - 1; i >= 0; --i) idx_.push_back(i);
+    constexpr LoadBuffer() : state_(), op_(), type_(), entry_(), Qj_(), Qk_(), Vj_(), Vk_(), StoreAddr_(),
+                             StoreData_(), time_(), ready_(), executed_(), getAddr_(), stores_(), waitJ_(),
+                             waitK_(), slot_(), idx_(), loadClock_(), storeClock_() {
+        for (int i = num_ - 1; i >= 0; --i) idx_.push_back(i);
+    }
+
+    void Resize(int num) {
+        Flush();
+        num_ = num;
+        Flush();
     }
 
     bool ifFull() const {
@@ -287,142 +610,214 @@ public:
         loadClock_.time = storeClock_.time = 0;
         loadClock_.tag = storeClock_.tag = 0;
         idx_.clear();
-        load_buffer tmp;
-        for (int i = kNum - 1; i >= 0; --i) {
+        for (int i = num_ - 1; i >= 0; --i) {
             idx_.push_back(i);
-            sta_[i] = tmp;
+            if (state_[i] == waitingCDB) {
+                waitJ_[Qj_[i]].reset(i);
+                waitK_[Qk_[i]].reset(i);
+            }
+            state_[i] = empty;
+            Qj_[i] = Qk_[i] = 0;
         }
+        ready_.clear();
+        executed_.clear();
+        getAddr_.clear();
+        stores_.clear();
     }
 
-    void Issue(int entry, Decode &decoder) { // L、B
+    void Issue(int entry, const Decode &decoder) { // L、B
+        ++stats.activity[kEnLbWrite];
         int tag = AssignTag();
-        sta_[tag].state = waitingCDB;
-        sta_[tag].op = decoder.op_;
-        sta_[tag].entry = entry;
-        sta_[tag].time = Clock;
+        state_[tag] = waitingCDB;
+        op_[tag] = decoder.op_;
+        entry_[tag] = entry;
+        time_[tag] = Clock;
+        Qj_[tag] = Qk_[tag] = 0;
         if (decoder.type_ == 'L') {
-            sta_[tag].type = 'L';
-            int rs1 = decoder.rs1_, e = rf.Reg_[rs1].entry;
-            if (e) {
-                if (rob.buffer_.getVal(e).ready) sta_[tag].Vj = rob.buffer_.getVal(e).val;
-                else sta_[tag].Qj = e;
-            } else sta_[tag].Vj = rf.Reg_[rs1].val;
-            sta_[tag].Vk = decoder.imm_;
-            sta_[tag].Qk = 0;
-        } else {
-            sta_[tag].type = 'S';
-            sta_[tag].Vj = decoder.imm_;
-            int rs1 = decoder.rs1_, e = rf.Reg_[rs1].entry;
-            if (e) {
-                if (rob.buffer_.getVal(e).ready) sta_[tag].Vj += rob.buffer_.getVal(e).val;
-                else sta_[tag].Qj = e;
-            } else sta_[tag].Vj += rf.Reg_[rs1].val;
-            int rs2 = decoder.rs2_;
-            e = rf.Reg_[rs2].entry;
-            if (e) {
-                if (rob.buffer_.getVal(e).ready) sta_[tag].Vk = rob.buffer_.getVal(e).val;
-                else sta_[tag].Qk = e;
-            } else sta_[tag].Vk = rf.Reg_[rs2].val;
+            type_[tag] = 'L';
+            int p = rf.map_[decoder.rs1_];
+            if (rf.ready_[p]) Vj_[tag] = rf.val_[p];
+            else Qj_[tag] = p, waitJ_[p].set(tag);
+            Vk_[tag] = decoder.imm_;
+        } else { // S, A (address without offset)
+            type_[tag] = decoder.type_;
+            stores_.set(tag);
+            slot_[rob.Slot(entry)] = tag;
+            Vj_[tag] = decoder.imm_;
+            int p = rf.map_[decoder.rs1_];
+            if (rf.ready_[p]) Vj_[tag] += rf.val_[p];
+            else Qj_[tag] = p, waitJ_[p].set(tag);
+            p = rf.map_[decoder.rs2_];
+            if (rf.ready_[p]) Vk_[tag] = rf.val_[p];
+            else Qk_[tag] = p, waitK_[p].set(tag);
         }
+        if (!Qj_[tag] && !Qk_[tag]) ready_.set(tag);
+    }
+
+    static int Width(RV32I_Order op) { // bytes touched by a load/store
+        if (op == LB || op == LBU || op == SB) return 1;
+        if (op == LH || op == LHU || op == SH) return 2;
+        return 4;
+    }
+
+    // Checks load i against older stores: -1 while it has to wait (an older
+    // store address is unknown, or the youngest overlapping older store does
+    // not cover the load), the tag of that store if it can forward, or num_
+    // if the load has to read memory.
+    int Disambiguate(int i) const {
+        int from = num_;
+        u_int32_t lo = StoreAddr_[i], hi = lo + Width(op_[i]);
+        for (int j = stores_.next(0); j >= 0; j = stores_.next(j + 1)) {
+            if (time_[j] >= time_[i]) continue;
+            if (type_[j] == 'A' || state_[j] == waitingCDB) return -1;
+            u_int32_t addr = StoreAddr_[j];
+            if (addr < hi && lo < addr + Width(op_[j]) && (from == num_ || time_[from] < time_[j])) from = j;
+        }
+        if (from == num_) return num_;
+        if (StoreAddr_[from] == lo && Width(op_[from]) >= Width(op_[i])) return from;
+        return -1;
+    }
+
+    // Load result from forwarded store data, narrowed/extended like memory.
+    static u_int32_t Extend(RV32I_Order op, u_int32_t data) {
+        Decode decoder;
+        if (op == LB) return decoder.sext(data & 0xff, 8);
+        if (op == LH) return decoder.sext(data & 0xffff, 16);
+        if (op == LBU) return data & 0xff;
+        if (op == LHU) return data & 0xffff;
+        return data;
+    }
+
+    // True if Execute/Broadcast would do nothing this cycle but tick loadClock_.
+    bool Idle() const {
+        if (loadClock_.time == 1) return false;
+        if (executed_.any() || ready_.any()) return false;
+        for (int i = getAddr_.next(0); i >= 0; i = getAddr_.next(i + 1)) {
+            int from = Disambiguate(i);
+            if (from >= 0 && (from < num_ || !loadClock_.time)) return false;
+        }
+        return true;
+    }
+
+    // Advances both countdowns by n cycles in which nothing else happens.
+    void Tick(int n) {
+        if (loadClock_.time) loadClock_.time -= n;
+        if (storeClock_.time) storeClock_.time -= n;
     }
 
     void Execute() {
         if (loadClock_.time) {
             loadClock_.time--;
-            if (!loadClock_.time) sta_[loadClock_.tag].state = executed;
-        }
-        for (int i = 0; i < kNum; i++) {
-            if (sta_[i].state == getAddr && sta_[i].type == 'L') {
-                int latestStore = sta_[i].time;
-                bool prepared = true;
-                for (int j = 0; j < kNum; j++) {
-                    if (sta_[j].type == 'S' && sta_[j].state == waitingCDB && sta_[j].time < sta_[i].time) {
-                        prepared = false;
-                        break;
-                    }
-                    if (sta_[j].state == waitingStore || sta_[j].state == storing || sta_[j].state == executed) {
-                        if ((sta_[i].StoreAddr == sta_[j].StoreAddr) &&
-                            ((latestStore < sta_[j].time && sta_[j].time < sta_[i].time) ||
-                             (latestStore == sta_[i].time && sta_[j].time < sta_[i].time))) {
-                            latestStore = sta_[j].time;
-                            sta_[i].StoreData = sta_[j].StoreData;
-                        }
-                    }
-                }
-                if (!prepared)continue;
-                if (latestStore != sta_[i].time) {
-                    sta_[i].state = executed;
-                    continue;
-                } else if (!loadClock_.time) {
-                    Decode decoder;
-                    if (sta_[i].op == LB) sta_[i].StoreData = decoder.sext(memory.readByte(sta_[i].StoreAddr), 8);
-                    else if (sta_[i].op == LH)
-                        sta_[i].StoreData = decoder.sext(memory.readHfWord(sta_[i].StoreAddr), 16);
-                    else if (sta_[i].op == LW) sta_[i].StoreData = decoder.sext(memory.readWord(sta_[i].StoreAddr), 32);
-                    else if (sta_[i].op == LBU) sta_[i].StoreData = (u_int32_t) memory.readByte(sta_[i].StoreAddr);
-                    else if (sta_[i].op == LHU) sta_[i].StoreData = (u_int32_t) memory.readHfWord(sta_[i].StoreAddr);
-                    sta_[i].state = loading;
-                    loadClock_.tag = i;
-                    loadClock_.time = 3;
-                }
-            }
+            if (!loadClock_.time) state_[loadClock_.tag] = executed, executed_.set(loadClock_.tag);
         }
+        Forward();
 
-        for (auto &i: sta_) {
-            if (i.state == waitingCDB && i.Ready()) {
-                if (i.type == 'L') {
-                    i.StoreAddr = i.Vj + i.Vk;
-                    i.state = getAddr;
-                } else if (i.type == 'S') {
-                    i.StoreAddr = rob.buffer_.getVal(i.entry).dest = i.Vj;
-                    i.StoreData = i.Vk;
-                    i.state = executed;
-                }
-                break;
+        int i = ready_.next(0);
+        if (i < 0) return;
+        ready_.reset(i);
+        ++stats.activity[kEnAluOp];
+        rob.Trace(entry_[i], "X");
+        if (type_[i] == 'L') {
+            StoreAddr_[i] = Vj_[i] + Vk_[i];
+            state_[i] = getAddr;
+            getAddr_.set(i);
+        } else if (type_[i] == 'S') {
+            StoreAddr_[i] = rob.buffer_.getVal(entry_[i]).dest = Vj_[i];
+            StoreData_[i] = Vk_[i];
+            state_[i] = executed;
+            executed_.set(i);
+        } else if (type_[i] == 'A') { // the memory side waits for commit
+            StoreAddr_[i] = Vj_[i];
+            StoreData_[i] = Vk_[i];
+            state_[i] = waitingStore;
+        }
+    }
+
+    // Sends every load with a known address to its forwarding store or, when
+    // the port is free, to memory.
+    void Forward() {
+        HOST_SCOPE(kHostLbForward);
+        for (int i = getAddr_.next(0); i >= 0; i = getAddr_.next(i + 1)) {
+            int from = Disambiguate(i);
+            if (from < 0) continue;
+            if (from < num_) {
+                StoreData_[i] = Extend(op_[i], StoreData_[from]);
+                state_[i] = executed;
+                getAddr_.reset(i);
+                executed_.set(i);
+                rob.Trace(entry_[i], "M");
+                if (depGraph)
+                    depGraph->Forward(rob.buffer_.getVal(entry_[i]).seq, rob.buffer_.getVal(entry_[from]).seq);
+            } else if (!loadClock_.time) {
+                int latency = 3;
+                if (cacheConfig.missLatency)
+                    latency += dcache.Load(rob.buffer_.getVal(entry_[i]).pc_now_, StoreAddr_[i], Clock);
+                // only a load fed a mispredicted value goes outside memory; it gets squashed
+                StoreData_[i] = StoreAddr_[i] <= size - 4 ? shared.Load(Hart, op_[i], StoreAddr_[i], latency) : 0;
+                ++stats.activity[kEnMemRead];
+                state_[i] = loading;
+                getAddr_.reset(i);
+                loadClock_.tag = i;
+                loadClock_.time = latency;
+                rob.Trace(entry_[i], "M");
             }
         }
     }
 
     bool Broadcast() {
-        for (int i = 0; i < kNum; ++i) {
-            if (sta_[i].state == executed && sta_[i].type == 'L') {
-                cdb = (CommonDataBus) {sta_[i].entry, sta_[i].StoreData};
-                sta_[i].state = empty;
-                RestoreTag(i);
-                return true;
-            }
-            if (sta_[i].state == executed && sta_[i].type == 'S') {
-                cdb = (CommonDataBus) {sta_[i].entry, sta_[i].StoreData};
-                sta_[i].state = waitingStore;
-                return true;
-            }
+        int i = executed_.next(0);
+        if (i < 0) return false;
+        rob.Trace(entry_[i], "Wb");
+        cdb = (CommonDataBus) {entry_[i], rob.Preg(entry_[i]), StoreData_[i]};
+        executed_.reset(i);
+        if (type_[i] == 'L') {
+            if (profiler) profiler->Load(rob.buffer_.getVal(entry_[i]).pc_now_, Clock - time_[i]);
+            state_[i] = empty;
+            RestoreTag(i);
+        } else {
+            state_[i] = waitingStore;
         }
-        return false;
+        return true;
     }
 
     void Reception() {
-        for (auto &i: sta_) {
-            if (i.state == waitingCDB) {
-                if (i.Qj == cdb.entry) {
-                    if (i.type == 'L') {
-                        i.Qj = 0, i.Vj = cdb.result;
-                    } else {
-                        i.Qj = 0, i.Vj += cdb.result;
-                    }
-                } else if (i.Qk == cdb.entry) i.Qk = 0, i.Vk = cdb.result;
-            }
+        StationSet &j = waitJ_[cdb.preg], &k = waitK_[cdb.preg];
+        stats.activity[kEnLbCompare] += num_;
+        for (int i = j.next(0); i >= 0; i = j.next(i + 1)) {
+            if (type_[i] == 'L') Qj_[i] = 0, Vj_[i] = cdb.result;
+            else Qj_[i] = 0, Vj_[i] += cdb.result;
+            if (!Qk_[i]) ready_.set(i);
+            ++stats.activity[kEnLbWrite];
         }
+        for (int i = k.next(0); i >= 0; i = k.next(i + 1)) {
+            Qk_[i] = 0, Vk_[i] = cdb.result;
+            if (!Qj_[i]) ready_.set(i);
+            ++stats.activity[kEnLbWrite];
+        }
+        j.clear();
+        k.clear();
     }
 
     void Commit(int entry) {
-        for (int i = 0; i < kNum; i++) {
-            if (sta_[i].entry == entry) {
-                sta_[i].state = storing;
-                storeClock_.tag = i;
-                storeClock_.time = 3;
-                break;
-            }
-        }
+        int i = slot_[rob.Slot(entry)];
+        state_[i] = storing;
+        rob.Trace(entry, "Cm");
+        storeClock_.tag = i;
+        storeClock_.time = 3;
+    }
+
+    // Performs the atomic of ROB entry `entry` at retirement; false while its
+    // operands are not in yet.
+    bool Atomic(int entry, u_int32_t &val) {
+        int i = slot_[rob.Slot(entry)];
+        if (state_[i] != waitingStore) return false;
+        val = shared.Atomic(Hart, op_[i], StoreAddr_[i], StoreData_[i]);
+        ++stats.activity[kEnMemRead];
+        if (op_[i] != LR_W) ++stats.activity[kEnMemWrite];
+        state_[i] = empty;
+        stores_.reset(i);
+        RestoreTag(i);
+        return true;
     }
 
     bool Storing() {
@@ -430,10 +825,12 @@ public:
             storeClock_.time--;
             if (!storeClock_.time) {
                 int i = storeClock_.tag;
-                if (sta_[i].op == SB) memory.writeByte(sta_[i].StoreAddr, sta_[i].StoreData & 0xff);
-                else if (sta_[i].op == SH) memory.writeHfWord(sta_[i].StoreAddr, sta_[i].StoreData & 0xffff);
-                else if (sta_[i].op == SW) memory.writeWord(sta_[i].StoreAddr, sta_[i].StoreData);
-                sta_[storeClock_.tag].state = empty;
+                shared.Store(Hart, op_[i], StoreAddr_[i], StoreData_[i]);
+                ++stats.activity[kEnMemWrite];
+                if (cacheConfig.missLatency) dcache.Store(StoreAddr_[i], Clock);
+                loopBuffer.Store(StoreAddr_[i]);
+                state_[i] = empty;
+                stores_.reset(i);
                 RestoreTag(i);
                 rob.deQueue();
                 return false;
@@ -441,147 +838,426 @@ public:
         } else return false;
         return true;
     }
-} lb;
+};
+
+thread_local LoadBuffer lb;
+
+// Where the cores meet at the end of every quantum.
+class QuantumBarrier {
+    std::mutex lock_;
+    std::condition_variable cv_;
+    int harts_, arrived_ = 0, halted_ = 0;
+    u_int64_t generation_ = 0;
+    bool done_ = false;
+
+public:
+    explicit QuantumBarrier(int harts) : harts_(harts) {}
+
+    // Blocks until every core has arrived; true once all of them have halted.
+    bool Arrive(bool halted) {
+        std::unique_lock<std::mutex> guard(lock_);
+        u_int64_t generation = generation_;
+        halted_ += halted;
+        if (++arrived_ == harts_) {
+            done_ = halted_ == harts_;
+            arrived_ = halted_ = 0;
+            ++generation_;
+            cv_.notify_all();
+        } else {
+            cv_.wait(guard, [&] { return generation_ != generation; });
+        }
+        return done_;
+    }
+};
+
+// What a core leaves behind for Simulator::Report once its thread is done.
+struct CoreSummary {
+    int cycles = 0;
+    Statistics stats;
+    u_int32_t result = 0; // a0 & 255
+};
+
+std::vector<CoreSummary> cores;
 
 class Simulator {
 public:
     static void Fetch() {
+        HOST_SCOPE(kHostFetch);
         if (isq.end_) return;
-        if (isq.ifFull() || isq.stall_) return;
-        u_int32_t order = memory.readWord(PC);
-
-        Decode decoder;
-        decoder.SetOrder(order);
-        decoder.decode();
-        if (decoder.type_ != 'B' && (decoder.type_ == 'S' || decoder.op_ == JALR || decoder.rd_ != 0))
-            isq.enQueue(PC, order);
-        if (order == 0x0ff00513) {
+        ftq.Predict(Clock);
+        if (isq.ifFull()) return ftq.Note(stats.backendStalls, Clock);
+        u_int32_t next;
+        bool taken;
+        if (isq.stall_ || !ftq.Next(PC, next, taken)) return ftq.Note(stats.frontendBubbles, Clock);
+        const LoopBuffer::Slot *hit = loopBuffer.Lookup(PC);
+        Decode inst;
+        if (hit) {
+            inst = hit->decoded;
+            ++stats.loopHits;
+        } else {
+            u_int32_t order = memory.readWord(PC);
+            ++stats.activity[kEnMemRead];
+            inst.SetOrder(order);
+            {
+                HOST_SCOPE(kHostDecode);
+                inst.decode();
+            }
+            ++stats.fetchReads;
+        }
+        u_int32_t pc = PC;
+        if (inst.type_ != 'B' && (inst.type_ == 'S' || inst.type_ == 'A' || inst.op_ == JALR || inst.rd_ != 0))
+            isq.enQueue(PC, inst);
+        if (inst.order_ == 0x0ff00513) {
             isq.end_ = true;
             return;
         }
-        if (decoder.op_ == JALR)
+        if (inst.op_ == JALR) {
             isq.stall_ = true;
-        else if (decoder.type_ == 'J') {
-            u_int32_t des = decoder.imm_ + PC;
+            ftq.Stop();
+        } else if (inst.type_ == 'J') {
+            u_int32_t des = inst.imm_ + PC;
             PC = des;
-        } else if (decoder.type_ == 'B') {
-            u_int32_t des = decoder.imm_ + PC;
-            if (predictor.Predict(PC)) {
-                isq.enQueue(PC, order, true);
-                PC = des;
-            } else {
-                isq.enQueue(PC, order, false);
-                PC += 4;
-            }
+        } else if (inst.type_ == 'B') {
+            u_int32_t des = inst.imm_ + PC;
+            isq.enQueue(PC, inst, taken);
+            PC = taken ? des : PC + 4;
         } else PC += 4;
+        if (inst.op_ != JALR && (PC != next || ftq.Stranded())) { // the predictor read something else here
+            ftq.Redirect(PC);
+            ++stats.resteers;
+        }
+        if (!hit && LoopBufferSize) loopBuffer.Fill(pc, inst, PC);
     }
 
     static void Issue() {
+        HOST_SCOPE(kHostIssue);
         if (isq.ifEmpty()) {
             Fetch();
             return;
         }
-        instruction_queue inst = isq.buffer_[0];
+        const instruction_queue &inst = isq.buffer_[0]; // Fetch only appends, deQueue leaves it in place
 //        std::cout<<std::dec<<inst.order<<'\n';
         Fetch();
-        Decode decoder;
-        decoder.SetOrder(inst.order);
-        decoder.decode();
-        if (decoder.type_ == 'U') {
+        const Decode &decoder = inst.decoded;
+        if (!Room(decoder)) {
+            if (RenameStalled(decoder)) ++stats.renameStalls;
+            return;
+        }
+        if (isq.buffer_.len > 1 && isq.buffer_[1].pc == inst.pc + 4) {
+            const instruction_queue &next = isq.buffer_[1];
+            int kind = Fusable(decoder, next.decoded);
+            if (kind) return IssueFused(kind, inst, next, decoder, next.decoded);
+        }
+        GraphSources(inst, decoder);
+        int src = MoveSource(decoder);
+        if (src >= 0) { // done by renaming: no station, no ALU, no CDB
             reorder_buffer tmp;
             tmp.type = decoder.type_;
             tmp.ready = true;
+            tmp.eliminated = true;
             tmp.order = decoder.order_;
+            tmp.pc_now_ = inst.pc;
             tmp.dest = decoder.rd_;
-            if (decoder.op_ == LUI) tmp.val = decoder.imm_;
-            else if (decoder.op_ == AUIPC) tmp.val = decoder.imm_ + inst.pc;
-            if (tmp.dest) { // 非F0
-                tmp.entry = rf.Reg_[tmp.dest].entry = rob.NewEntry();
-                ++rob.entry_num_;
-                rob.buffer_.enQueue(tmp);
-            }
+            tmp.entry = rob.NewEntry();
+            ++rob.entry_num_;
+            tmp.preg = rf.Share(tmp.dest, src, tmp.old);
+            rob.buffer_.enQueue(tmp);
+            ++stats.activity[kEnRobWrite];
             isq.deQueue();
-        } else if (decoder.type_ == 'J') {
+            TraceIssue(inst, true);
+        } else if (decoder.type_ == 'U' || decoder.type_ == 'J') {
             reorder_buffer tmp;
             tmp.type = decoder.type_;
             tmp.ready = true;
             tmp.order = decoder.order_;
+            tmp.pc_now_ = inst.pc;
             tmp.dest = decoder.rd_;
-            tmp.val = inst.pc + 4;
             if (tmp.dest) { // 非F0
-                tmp.entry = rf.Reg_[tmp.dest].entry = rob.NewEntry();
+                u_int32_t val = inst.pc + 4;
+                if (decoder.op_ == LUI) val = decoder.imm_;
+                else if (decoder.op_ == AUIPC) val = decoder.imm_ + inst.pc;
+                tmp.entry = rob.NewEntry();
                 ++rob.entry_num_;
+                tmp.preg = rf.Rename(tmp.dest, tmp.old);
+                rf.Write(tmp.preg, val);
                 rob.buffer_.enQueue(tmp);
+                ++stats.activity[kEnRobWrite];
             }
             isq.deQueue();
-        } else if (decoder.type_ == 'L' || decoder.type_ == 'S') {
-            if (lb.ifFull() || rob.ifFull()) return;
+            TraceIssue(inst, tmp.dest);
+        } else if (decoder.type_ == 'L' || decoder.type_ == 'S' || decoder.type_ == 'A') {
             isq.deQueue();
             lb.Issue(rob.NewEntry(), decoder);
             rob.Issue(decoder, inst.pc);
+            if (decoder.type_ == 'L' && valueConfig.mode) PredictValue();
+            TraceIssue(inst, true);
         } else if (decoder.type_ == 'B') {
-            if (rs.ifFull() || rob.ifFull()) return;
             isq.deQueue();
             u_int32_t des = decoder.imm_ + inst.pc;
             rs.Issue(rob.NewEntry(), decoder);
             rob.Issue(decoder, inst.pc, des, inst.jump);
+            TraceIssue(inst, true);
         } else { // I、R
-            if (rs.ifFull() || rob.ifFull()) return;
             isq.deQueue();
             rs.Issue(rob.NewEntry(), decoder);
             rob.Issue(decoder, inst.pc);
+            TraceIssue(inst, true);
+        }
+    }
+
+    // Macro-op formed by the adjacent isq pair a, b (a FusionKind), 0 if none.
+    // The pair always writes a's rd last, so a's own result is never needed.
+    static int Fusable(const Decode &a, const Decode &b) {
+        int rd = a.rd_;
+        if (!rd) return 0;
+        if ((Fusion & kFuseLui) && a.op_ == LUI && b.op_ == ADDI && b.rd_ == rd && b.rs1_ == rd) return kFuseLui;
+        if ((Fusion & kFuseCall) && a.op_ == AUIPC && b.op_ == JALR && b.rd_ == rd && b.rs1_ == rd) return kFuseCall;
+        if ((Fusion & kFuseShiftAdd) && a.op_ == SLLI && a.imm_ >= 1 && a.imm_ <= 3 && b.op_ == ADD &&
+            b.rd_ == rd && (b.rs1_ == rd) != (b.rs2_ == rd))
+            return kFuseShiftAdd;
+        if ((Fusion & kFuseBranch) && (a.op_ == SLT || a.op_ == SLTU || a.op_ == SLTI || a.op_ == SLTIU) &&
+            (b.op_ == BEQ || b.op_ == BNE) && ((b.rs1_ == rd && !b.rs2_) || (!b.rs1_ && b.rs2_ == rd)))
+            return kFuseBranch;
+        return 0;
+    }
+
+    // Issues the isq pair inst, next (decoded a, b) as a single ROB entry;
+    // Room(a) covers what it takes.
+    static void IssueFused(int kind, const instruction_queue &inst, const instruction_queue &next,
+                           const Decode &a, const Decode &b) {
+        isq.deQueue();
+        isq.deQueue();
+        if (kind != kFuseShiftAdd) GraphSources(inst, a);
+        if (kind == kFuseLui || kind == kFuseCall) { // complete at rename, like a lone lui/jal
+            reorder_buffer tmp;
+            tmp.type = kind == kFuseLui ? 'U' : 'J';
+            tmp.ready = true;
+            tmp.order = a.order_;
+            tmp.pc_now_ = inst.pc;
+            tmp.dest = b.rd_;
+            tmp.entry = rob.NewEntry();
+            ++rob.entry_num_;
+            tmp.preg = rf.Rename(tmp.dest, tmp.old);
+            if (kind == kFuseLui) {
+                rf.Write(tmp.preg, a.imm_ + b.imm_);
+            } else {
+                ALU alu;
+                rf.Write(tmp.preg, next.pc + 4);
+                PC = alu.calc(JALR, inst.pc + a.imm_, b.imm_);
+                isq.stall_ = false;
+                ftq.Redirect(PC);
+            }
+            rob.buffer_.enQueue(tmp);
+            ++stats.activity[kEnRobWrite];
+        } else if (kind == kFuseShiftAdd) {
+            Decode fused = b;
+            fused.op_ = (RV32I_Order) (SH1ADD + a.imm_ - 1);
+            fused.rs1_ = a.rs1_;
+            fused.rs2_ = b.rs1_ == a.rd_ ? b.rs2_ : b.rs1_;
+            fused.order_ = a.order_;
+            GraphSources(inst, fused);
+            rs.Issue(rob.NewEntry(), fused);
+            rob.Issue(fused, inst.pc);
+        } else { // the station computes the compare; the branch reads it at commit
+            rs.Issue(rob.NewEntry(), a);
+            rob.Issue(a, inst.pc, b.imm_ + next.pc, next.jump);
+            rob.buffer_.getVal(rob.entry_num_ - 1).type = 'B';
+        }
+        reorder_buffer &tail = rob.buffer_.getVal(rob.entry_num_ - 1);
+        tail.fuse = kind;
+        tail.order2 = b.order_;
+        TraceIssue(inst, true);
+        if (depGraph && kind == kFuseCall) depGraph->Redirect(inst.seq, 'j');
+        if (tracer) {
+            tracer->Stage(next.seq, "Fu");
+            tracer->Retire(next.seq);
+        }
+    }
+
+    // Gives the load just issued to the ROB tail its predicted value, if the
+    // predictor is confident: consumers issued from now on find it ready.
+    // The load's own result checks it in ROB::Reception.
+    static void PredictValue() {
+        reorder_buffer &tail = rob.buffer_.getVal(rob.entry_num_ - 1);
+        u_int32_t value;
+        if (!tail.preg || !valuePredictor.Predict(tail.pc_now_, value)) return;
+        rf.Write(tail.preg, value);
+        tail.predicted = true;
+    }
+
+    // Throws away everything younger than the instruction just retired and
+    // fetches again from pc.
+    static void Squash(u_int32_t pc) {
+        PC = pc;
+        ++stats.flushes;
+        ++stats.activity[kEnFlush];
+        stats.squashed += rob.buffer_.len + isq.buffer_.len;
+        isq.Flush();
+        rs.Flush();
+        lb.Flush();
+        rob.Flush();
+        rf.Recover();
+        if (valueConfig.mode) valuePredictor.Flush();
+        ftq.Redirect(PC);
+        Fetch();
+    }
+
+    // True if the decoded isq head has what it needs to issue: a station,
+    // a ROB entry and, when it writes a register, a free physical register.
+    static bool Room(const Decode &decoder) {
+        if (MoveSource(decoder) >= 0) return !rob.ifFull();
+        return !(decoder.rd_ && rf.ifFull()) && Slots(decoder);
+    }
+
+    static bool Slots(const Decode &decoder) {
+        if (decoder.type_ == 'U' || decoder.type_ == 'J') return !decoder.rd_ || !rob.ifFull();
+        if (decoder.type_ == 'L' || decoder.type_ == 'S' || decoder.type_ == 'A')
+            return !lb.ifFull() && !rob.ifFull();
+        return !rs.ifFull() && !rob.ifFull();
+    }
+
+    // True if only the empty free list holds the decoded isq head back.
+    static bool RenameStalled(const Decode &decoder) {
+        return decoder.rd_ && rf.ifFull() && Slots(decoder) && MoveSource(decoder) < 0;
+    }
+
+    // Source register whose value an ALU instruction merely copies into rd
+    // (x0 for idioms that always give zero), or -1.
+    static int MoveSource(const Decode &decoder) {
+        if (!Eliminate || !decoder.rd_) return -1;
+        int rs1 = decoder.rs1_, rs2 = decoder.rs2_;
+        switch (decoder.op_) {
+            case ADDI:
+            case ORI:
+            case XORI:
+                return decoder.imm_ ? -1 : rs1;
+            case ANDI:
+                return decoder.imm_ && rs1 ? -1 : 0;
+            case ADD:
+            case OR:
+            case XOR:
+                if (decoder.op_ != ADD && rs1 == rs2) return decoder.op_ == OR ? rs1 : 0;
+                return !rs2 ? rs1 : !rs1 ? rs2 : -1;
+            case SUB:
+                return rs1 == rs2 ? 0 : !rs2 ? rs1 : -1;
+            case AND:
+                return !rs1 || !rs2 ? 0 : rs1 == rs2 ? rs1 : -1;
+            default:
+                return -1;
         }
     }
 
+    // The isq head `inst` was dispatched to the ROB tail, or retired right
+    // away if it is an x0-writing LUI/AUIPC/JAL that never gets an entry.
+    static void TraceIssue(const instruction_queue &inst, bool inRob) {
+        if (!inRob) {
+            if (tracer) tracer->Retire(inst.seq);
+            return;
+        }
+        reorder_buffer &tail = rob.buffer_.getVal(rob.entry_num_ - 1);
+        tail.seq = inst.seq;
+        if (tracer) tracer->Stage(inst.seq, tail.ready ? "Wb" : "Is");
+        if (depGraph) depGraph->Issue(inst.seq, tail.eliminated ? 0 : tail.preg, tail.ready);
+    }
+
+    // Records which in-flight instructions produce the operands of the isq
+    // head `inst` (decoded d) in the dependency graph; before it renames.
+    static void GraphSources(const instruction_queue &inst, const Decode &d) {
+        if (!depGraph) return;
+        bool one = d.type_ != 'U' && d.type_ != 'J', two = one && d.type_ != 'I' && d.type_ != 'L';
+        depGraph->Sources(inst.seq, one ? rf.map_[d.rs1_] : 0, two ? rf.map_[d.rs2_] : 0);
+    }
+
     static void Execute() {
+        HOST_SCOPE(kHostExecute);
         lb.Execute();
         rs.Execute();
     }
 
     static void WriteResult() {
+        HOST_SCOPE(kHostWriteResult);
         if (!rs.Broadcast() && !lb.Broadcast()) return;
+        ++stats.activity[kEnCdbBroadcast];
+        HOST_SCOPE(kHostWakeup);
         rs.Reception();
         lb.Reception();
         rob.Reception();
     }
 
     static void Commit() {
+        HOST_SCOPE(kHostCommit);
         if (lb.Storing()) return;
         if (rob.ifEmpty()) return;
         reorder_buffer inf = rob.buffer_[0];
-        if (!inf.ready) return;
+        if (inf.type == 'A') {
+            if (!lb.Atomic(inf.entry, inf.val)) return;
+            ++stats.atomics;
+            if (inf.preg) { // the result only exists now: wake its consumers
+                cdb = (CommonDataBus) {inf.entry, inf.preg, inf.val};
+                ++stats.activity[kEnCdbBroadcast];
+                rf.Write(inf.preg, inf.val);
+                rs.Reception();
+                lb.Reception();
+            }
+        } else if (!inf.ready) return;
+        if (inf.fuse == kFuseBranch) {
+            Decode branch;
+            branch.SetOrder(inf.order2);
+            branch.decode();
+            inf.val = (rf.val_[inf.preg] != 0) != (branch.op_ == BEQ);
+        } else if (inf.dest && inf.type != 'S') inf.val = rf.val_[inf.preg];
+        if (cosim.enabled_) {
+            if (inf.fuse == kFuseBranch) {
+                cosim.Retire(Clock, inf.pc_now_, inf.order, rf.val_[inf.preg]);
+                cosim.Retire(Clock, inf.pc_now_ + 4, inf.order2, inf.val);
+            } else if (inf.fuse) {
+                cosim.RetireFused(Clock, inf.pc_now_, inf.order);
+                cosim.Retire(Clock, inf.pc_now_ + 4, inf.order2, inf.val);
+            } else cosim.Retire(Clock, inf.pc_now_, inf.order, inf.val, inf.dest);
+        }
         if (inf.order == 0x0ff00513u) {
-            std::cout << std::dec << (rf.Reg_[10].val & 255u) << '\n';
-//            std::cout << predictor.Accuracy() << '\n';
-            exit(0);
+            if (!Hart) std::cout << std::dec << (rf.Arch(10) & 255u) << '\n';
+            rob.deQueue();
+            Halted = true;
+            return;
+        }
+        ++stats.committed;
+        if (profiler) profiler->Retire(inf.pc_now_, inf.order);
+        if (inf.fuse) {
+            ++stats.committed;
+            ++stats.fused[__builtin_ctz(inf.fuse)];
+            if (profiler) profiler->Retire(inf.pc_now_ + 4, inf.order2);
         }
         if (inf.type == 'S') {
             lb.Commit(inf.entry);
         } else if (inf.type == 'B') {
+            ++stats.branches;
+            if (inf.dest) rf.Retire(inf.dest, inf.preg, inf.old); // fused compare
+            u_int32_t pc = inf.fuse ? inf.pc_now_ + 4 : inf.pc_now_;
             if (inf.val != inf.jump) {
-                if (inf.jump) PC = inf.pc_now_ + 4;
-                else PC = inf.pc_des_;
-                isq.Flush();
-                rs.Flush();
-                lb.Flush();
-                rob.Flush();
-                rf.Flush();
-                Fetch();
-                predictor.Feedback(inf.pc_now_, inf.val, false);
+                ++stats.mispredicts;
+                if (profiler) profiler->Mispredict(pc);
+                if (depGraph) depGraph->Redirect(inf.seq, 'b');
+                rob.deQueue();
+                Squash(inf.jump ? pc + 4 : inf.pc_des_);
+                predictor.Feedback(pc, inf.val, false);
+                ++stats.activity[kEnPredictUpdate];
             } else {
                 rob.deQueue();
-                predictor.Feedback(inf.pc_now_, inf.val, true);
+                predictor.Feedback(pc, inf.val, true);
+                ++stats.activity[kEnPredictUpdate];
             }
         } else {
-            if (inf.dest) {
-                rf.Reg_[inf.dest].val = inf.val;
-                if (rf.Reg_[inf.dest].entry == inf.entry) rf.Reg_[inf.dest].entry = 0;
+            if (inf.dest) rf.Retire(inf.dest, inf.preg, inf.old);
+            if (inf.eliminated) ++stats.eliminated;
+            if (inf.type == 'L' && valueConfig.mode) {
+                valuePredictor.Train(inf.pc_now_, inf.val);
+                ++stats.valueLoads;
+                if (inf.predicted) ++(inf.replay ? stats.valueReplays : stats.valueCorrect);
             }
-            cdb = (CommonDataBus) {inf.entry, inf.val};
-            rs.Reception();
-            lb.Reception();
-
+            if (inf.replay && depGraph) depGraph->Redirect(inf.seq, 'v');
             rob.deQueue();
+            if (inf.replay) Squash(inf.pc_now_ + 4);
         }
     }
 
@@ -603,19 +1279,313 @@ public:
         }
     }
 
-    static void Run() {
+    // Nothing but the load/store countdowns can change in the coming cycle:
+    // no ready or finished RS/LB entry, nothing to commit, fetch blocked and
+    // the isq head (if any) stuck on a full structure.
+    static bool Quiescent() {
+        if (!isq.end_ && !isq.stall_ && !isq.ifFull()) return false;
+        if (!isq.end_ && ftq.Busy()) return false;
+        if (!lb.storeClock_.time && !rob.ifEmpty() && (rob.buffer_[0].ready || rob.buffer_[0].type == 'A'))
+            return false;
+        if (!isq.ifEmpty() && Room(isq.buffer_[0].decoded)) return false;
+        return rs.Idle() && lb.Idle();
+    }
+
+    // Fewest cycles worth skipping. Without data cache misses a countdown
+    // leaves at most two, and checking for them every cycle costs more than
+    // stepping through the few that turn out to be quiescent.
+    static const int kMinIdle = 3;
+
+    // Number of upcoming cycles that can be skipped: up to (not including)
+    // the cycle in which the earliest load/store countdown expires.
+    static int IdleCycles() {
+        HOST_SCOPE(kHostSkip);
+        int load = lb.loadClock_.time, store = lb.storeClock_.time;
+        int next = !load ? store : !store ? load : std::min(load, store);
+        if (next - 1 < kMinIdle || !Quiescent()) return 0;
+        return next - 1;
+    }
+
+    static void Report(std::ostream &os, double seconds) {
+        CoreSummary total;
+        for (auto &core: cores) {
+            total.cycles = std::max(total.cycles, core.cycles);
+            total.stats.committed += core.stats.committed;
+            total.stats.branches += core.stats.branches;
+            total.stats.mispredicts += core.stats.mispredicts;
+            total.stats.skipped += core.stats.skipped;
+            total.stats.atomics += core.stats.atomics;
+            total.stats.renameStalls += core.stats.renameStalls;
+            total.stats.eliminated += core.stats.eliminated;
+            for (int k = 0; k < 4; ++k) total.stats.fused[k] += core.stats.fused[k];
+            total.stats.robOccupancy += core.stats.robOccupancy;
+            total.stats.loopHits += core.stats.loopHits;
+            total.stats.fetchReads += core.stats.fetchReads;
+            total.stats.loops += core.stats.loops;
+            total.stats.rsOccupancy += core.stats.rsOccupancy;
+            total.stats.lbOccupancy += core.stats.lbOccupancy;
+            total.stats.flushes += core.stats.flushes;
+            total.stats.squashed += core.stats.squashed;
+            for (int e = 0; e < kEnergyEvents; ++e) total.stats.activity[e] += core.stats.activity[e];
+            total.stats.dcacheAccesses += core.stats.dcacheAccesses;
+            total.stats.dcacheMisses += core.stats.dcacheMisses;
+            total.stats.prefetchIssued += core.stats.prefetchIssued;
+            total.stats.prefetchUseful += core.stats.prefetchUseful;
+            total.stats.prefetchLate += core.stats.prefetchLate;
+            total.stats.prefetchUnused += core.stats.prefetchUnused;
+            total.stats.ftqBlocks += core.stats.ftqBlocks;
+            total.stats.ftqOccupancy += core.stats.ftqOccupancy;
+            total.stats.frontendBubbles += core.stats.frontendBubbles;
+            total.stats.backendStalls += core.stats.backendStalls;
+            total.stats.resteers += core.stats.resteers;
+            total.stats.valueLoads += core.stats.valueLoads;
+            total.stats.valueCorrect += core.stats.valueCorrect;
+            total.stats.valueReplays += core.stats.valueReplays;
+            total.stats.prfPeak = std::max(total.stats.prfPeak, core.stats.prfPeak);
+        }
+        const Statistics &st = total.stats;
+        u_int64_t fused = st.fused[0] + st.fused[1] + st.fused[2] + st.fused[3], cycles = 0;
+        for (auto &core: cores) cycles += core.cycles;
+        // every core leaks until it halts; the run takes as long as the slowest
+        double nj = (energyModel.Dynamic(st.activity) + energyModel.Static(cycles, window.Entries())) / 1e3;
+        double us = energyModel.Microseconds(total.cycles);
+        os << std::dec << std::fixed << std::setprecision(4)
+           << "cycles " << total.cycles << '\n'
+           << "instructions " << st.committed << '\n'
+           << "ipc " << (total.cycles ? 1.0 * st.committed / total.cycles : 0.0) << '\n'
+           << "branches " << st.branches << '\n'
+           << "mispredicts " << st.mispredicts << '\n'
+           << "bp_accuracy " << (st.branches ? 1.0 * (st.branches - st.mispredicts) / st.branches : 1.0) << '\n'
+           << "skipped_cycles " << st.skipped << '\n'
+           << "atomics " << st.atomics << '\n'
+           << "rename_stalls " << st.renameStalls << '\n'
+           << "eliminated " << st.eliminated << '\n'
+           << "fused_lui_addi " << st.fused[0] << '\n'
+           << "fused_auipc_jalr " << st.fused[1] << '\n'
+           << "fused_slli_add " << st.fused[2] << '\n'
+           << "fused_compare_branch " << st.fused[3] << '\n'
+           << "fusion_rate " << (st.committed ? 2.0 * fused / st.committed : 0.0) << '\n'
+           << "rob_occupancy " << (cycles ? 1.0 * st.robOccupancy / cycles : 0.0) << '\n'
+           << "rs_occupancy " << (cycles ? 1.0 * st.rsOccupancy / cycles : 0.0) << '\n'
+           << "lb_occupancy " << (cycles ? 1.0 * st.lbOccupancy / cycles : 0.0) << '\n'
+           << "flushes " << st.flushes << '\n'
+           << "squashed " << st.squashed << '\n'
+           << "ftq_blocks " << st.ftqBlocks << '\n'
+           << "ftq_occupancy " << (cycles ? 1.0 * st.ftqOccupancy / cycles : 0.0) << '\n'
+           << "frontend_bubbles " << st.frontendBubbles << '\n'
+           << "backend_stalls " << st.backendStalls << '\n'
+           << "fetch_resteers " << st.resteers << '\n'
+           << "loops_buffered " << st.loops << '\n'
+           << "loop_buffer_hits " << st.loopHits << '\n'
+           << "fetch_memory_reads " << st.fetchReads << '\n'
+           << "loop_buffer_hit_rate "
+           << (st.loopHits + st.fetchReads ? 1.0 * st.loopHits / (st.loopHits + st.fetchReads) : 0.0) << '\n'
+           << "physical_registers " << window.Physical() << '\n'
+           << "prf_peak " << st.prfPeak << '\n';
+        for (int e = 0; e < kEnergyEvents; ++e) os << "activity_" << kEnergyEventName[e] << ' ' << st.activity[e] << '\n';
+        os << "energy_nj " << nj << '\n'
+           << "delay_us " << us << '\n'
+           << "avg_power_mw " << (us > 0 ? nj / us : 0.0) << '\n'
+           << "edp_nj_us " << nj * us << '\n';
+        if (cores.size() > 1) {
+            for (size_t h = 0; h < cores.size(); ++h) {
+                os << "core" << h << "_cycles " << cores[h].cycles << '\n'
+                   << "core" << h << "_instructions " << cores[h].stats.committed << '\n'
+                   << "core" << h << "_a0 " << cores[h].result << '\n';
+            }
+            shared.Report(os);
+        }
+        if (cacheConfig.missLatency) {
+            // coverage: misses removed; accuracy: prefetches used; timeliness: used ones in time
+            u_int64_t covered = st.prefetchUseful + st.prefetchLate;
+            os << "dcache_accesses " << st.dcacheAccesses << '\n'
+               << "dcache_misses " << st.dcacheMisses << '\n'
+               << "dcache_miss_rate " << (st.dcacheAccesses ? 1.0 * st.dcacheMisses / st.dcacheAccesses : 0.0) << '\n'
+               << "prefetch_issued " << st.prefetchIssued << '\n'
+               << "prefetch_useful " << st.prefetchUseful << '\n'
+               << "prefetch_late " << st.prefetchLate << '\n'
+               << "prefetch_unused " << st.prefetchUnused << '\n'
+               << "prefetch_coverage " << (covered ? 1.0 * covered / (covered + st.dcacheMisses) : 0.0) << '\n'
+               << "prefetch_accuracy " << (st.prefetchIssued ? 1.0 * covered / st.prefetchIssued : 0.0) << '\n'
+               << "prefetch_timeliness " << (covered ? 1.0 * st.prefetchUseful / covered : 0.0) << '\n';
+        }
+        if (valueConfig.mode) {
+            // coverage: retired loads that were predicted; accuracy: of those, right
+            u_int64_t predicted = st.valueCorrect + st.valueReplays;
+            os << "value_loads " << st.valueLoads << '\n'
+               << "value_predicted " << predicted << '\n'
+               << "value_correct " << st.valueCorrect << '\n'
+               << "value_replays " << st.valueReplays << '\n'
+               << "value_coverage " << (st.valueLoads ? 1.0 * predicted / st.valueLoads : 0.0) << '\n'
+               << "value_accuracy " << (predicted ? 1.0 * st.valueCorrect / predicted : 0.0) << '\n';
+        }
+        if (cosim.enabled_) os << "cosim_checked " << cosim.checked_ << '\n';
+#ifdef RISCV_HOST_PROFILE
+        // ns per simulated cycle (summed over cores) and per instruction
+        double ns[kHostStages];
+        for (int s = 0; s < kHostStages; ++s) ns[s] = hostTotal.Ticks(s) * hostClock.nsPerTick;
+        double other = ns[kHostStep];
+        for (int s = kHostCommit; s <= kHostSkip; ++s) other -= ns[s];
+        other = std::max(other, 0.0); // sampling noise when the stages cover nearly all of it
+        for (int s = 0; s <= kHostStages; ++s) {
+            if (s == kHostStep) continue; // equals total once the reads are taken off
+            const char *name = s < kHostStages ? kHostStageName[s] : "other";
+            double t = s < kHostStages ? ns[s] : other;
+            os << "host_" << name << "_ns_per_cycle " << (cycles ? t / cycles : 0.0) << '\n'
+               << "host_" << name << "_ns_per_inst " << (st.committed ? t / st.committed : 0.0) << '\n';
+        }
+        os << "host_sampled_steps " << hostTotal.sampled_ << " / " << hostTotal.steps_ << '\n'
+           << "host_timer_ns_per_read " << hostTotal.ReadCost() * hostClock.nsPerTick << '\n';
+#endif
+        os
+           << "wall_seconds " << seconds << '\n'
+           << "host_mips " << (seconds > 0 ? st.committed / seconds / 1e6 : 0.0) << '\n';
+    }
+
+    // Simulates `harts` cores sharing memory, each on its own host thread, in
+    // quanta of `quantum` cycles: no core starts a quantum before all cores
+    // have finished the previous one. Hart h starts at PC 0 with a0 = h;
+    // the run ends when every core has reached the end instruction.
+    static void Run(unsigned seed, bool skipIdle = true, int harts = 1, int quantum = 1000) {
+        shared.SetHarts(harts);
+        cores.assign(harts, CoreSummary());
+        QuantumBarrier barrier(harts);
+        if (harts == 1) quantum = INT_MAX;
+        std::vector<std::thread> threads;
+#ifdef RISCV_HOST_PROFILE
+        hostClock.Start();
+#endif
+        for (int h = 1; h < harts; ++h)
+            threads.emplace_back(RunCore, h, seed + h, skipIdle, quantum, std::ref(barrier));
+        RunCore(0, seed, skipIdle, quantum, barrier);
+        for (auto &t: threads) t.join();
+#ifdef RISCV_HOST_PROFILE
+        hostClock.Stop();
+#endif
+    }
+
+private:
+    static void RunCore(int hart, unsigned seed, bool skipIdle, int quantum, QuantumBarrier &barrier) {
+        Hart = hart;
+        rob.buffer_.Resize(window.rob);
+        rs.Resize(window.rs);
+        lb.Resize(window.lb);
+        rf.Resize(window.Physical());
+        loopBuffer.Resize(LoopBufferSize);
+        ftq.Resize(FtqSize);
+        dcache.Reset();
+        valuePredictor.Reset();
+        rf.val_[rf.retire_[10]] = hart;
+        if (!hart && warmStart.valid) {
+            for (int r = 1; r < 32; ++r) rf.val_[rf.retire_[r]] = warmStart.reg[r];
+            PC = warmStart.pc;
+            ftq.Redirect(PC);
+        }
+        if (!TracePath.empty()) {
+            std::string path = hart ? TracePath + "." + std::to_string(hart) : TracePath;
+            tracer = new PipelineTracer;
+            if (!tracer->Open(path, hart, &Clock)) {
+                std::cerr << "cannot open " << path << '\n';
+                delete tracer;
+                tracer = nullptr;
+            }
+        }
+        if (!GraphPath.empty()) {
+            std::string path = hart ? GraphPath + "." + std::to_string(hart) : GraphPath;
+            depGraph = new DependencyRecorder;
+            if (!depGraph->Open(path, hart, &Clock, window.rob, window.rs, window.lb, isq.buffer_.cap,
+                                window.Physical())) {
+                std::cerr << "cannot open " << path << '\n';
+                delete depGraph;
+                depGraph = nullptr;
+            }
+        }
+        if (!IntervalPath.empty()) {
+            std::string path = hart ? IntervalPath + "." + std::to_string(hart) : IntervalPath;
+            intervals = new IntervalRecorder;
+            if (!intervals->Open(path, IntervalPeriod, IntervalByInsts, Clock, window.Entries())) {
+                std::cerr << "cannot open " << path << '\n';
+                delete intervals;
+                intervals = nullptr;
+            }
+        }
+        if (!ProfilePath.empty()) {
+            profiler = new HotspotProfiler;
+            if (!SymbolPath.empty() && !profiler->LoadSymbols(SymbolPath))
+                std::cerr << "cannot open " << SymbolPath << '\n';
+        }
         std::vector<int> v = {1, 2, 3, 4};
-        std::random_device rd;
-        std::mt19937 rng(rd());
-        while (true) {
+        std::mt19937 rng(seed);
+        for (int limit = quantum;; limit = limit > INT_MAX - quantum ? INT_MAX : limit + quantum) {
+            RunUntil(rng, v, skipIdle, limit);
+            if (barrier.Arrive(Halted)) break;
+        }
+        CoreSummary &core = cores[hart];
+        stats.prfPeak = rf.peak_;
+        stats.loops = loopBuffer.loops_;
+        core.cycles = Clock;
+        core.stats = stats;
+        core.result = rf.Arch(10) & 255u;
+#ifdef RISCV_HOST_PROFILE
+        {
+            std::lock_guard<std::mutex> guard(hostTotalLock);
+            hostTotal.Add(hostProfile);
+        }
+#endif
+        delete tracer;
+        tracer = nullptr;
+        delete depGraph;
+        depGraph = nullptr;
+        if (intervals) {
+            intervals->Finish(Clock, stats);
+            delete intervals;
+            intervals = nullptr;
+        }
+        if (profiler) {
+            std::string path = hart ? ProfilePath + "." + std::to_string(hart) : ProfilePath;
+            if (!profiler->Write(path)) std::cerr << "cannot write " << path << ".txt/.folded\n";
+            delete profiler;
+            profiler = nullptr;
+        }
+    }
+
+    // Draws this cycle's stage order.
+    static void Shuffle(std::vector<int> &v, std::mt19937 &rng) {
+        HOST_SCOPE(kHostShuffle);
+        std::shuffle(v.begin(), v.end(), rng);
+    }
+
+    // Steps this thread's core until it halts or its clock reaches limit.
+    static void RunUntil(std::mt19937 &rng, std::vector<int> &v, bool skipIdle, int limit) {
+        HOST_TOTAL();
+        while (!Halted && Clock < limit) {
+            HOST_STEP();
+            HOST_SCOPE(kHostStep);
+            int idle = skipIdle ? std::min(IdleCycles(), limit - Clock - 1) : 0;
+            if (idle) {
+                HOST_SCOPE(kHostSkip);
+                Clock += idle;
+                stats.skipped += idle;
+                if (!isq.ifEmpty() && RenameStalled(isq.buffer_[0].decoded)) stats.renameStalls += idle;
+                if (!isq.end_) (isq.ifFull() ? stats.backendStalls : stats.frontendBubbles) += idle;
+                lb.Tick(idle);
+                // keep the stage order stream in step with an unskipped run
+                for (int i = 0; i < idle; ++i) std::shuffle(v.begin(), v.end(), rng);
+            }
+            stats.robOccupancy += (u_int64_t) rob.buffer_.len * (idle + 1);
+            stats.rsOccupancy += (u_int64_t) (rs.num_ - rs.idx_.count()) * (idle + 1);
+            stats.lbOccupancy += (u_int64_t) (lb.num_ - lb.idx_.count()) * (idle + 1);
+            stats.ftqOccupancy += (u_int64_t) ftq.buffer_.len * (idle + 1);
+            if (profiler) profiler->Cycles(rob.ifEmpty() ? HotspotProfiler::Empty() : rob.buffer_[0].pc_now_, idle + 1);
             ++Clock;
-            std::shuffle(v.begin(), v.end(), rng);
+            Shuffle(v, rng);
             for (int n: v) {
                 if (n == 1) Commit();
                 else if (n == 2) WriteResult();
                 else if (n == 3) Execute();
                 else if (n == 4) Issue();
             }
+            if (intervals) intervals->Sample(Clock, stats);
         }
     }
 
@@ -0,0 +1,45 @@
+#ifndef RISC_V_STATS_H
+#define RISC_V_STATS_H
+
+#include <iostream>
+#include "energy.h"
+
+// Event counters of a Tomasulo core, reported by Simulator::Report.
+struct Statistics {
+    u_int64_t committed = 0;   // retired ROB entries
+    u_int64_t branches = 0;
+    u_int64_t mispredicts = 0;
+    u_int64_t skipped = 0;     // idle cycles jumped over by Run
+    u_int64_t atomics = 0;     // retired LR/SC/AMO
+    u_int64_t renameStalls = 0; // cycles the isq head waited for a free physical register
+    u_int64_t prfPeak = 0;     // most physical registers in use at once
+    u_int64_t eliminated = 0;  // retired moves and zeroing idioms done by renaming
+    u_int64_t fused[4] = {};   // retired macro-op pairs: lui+addi, auipc+jalr, slli+add, compare+branch
+    u_int64_t robOccupancy = 0; // ROB entries in use, summed over cycles
+    u_int64_t rsOccupancy = 0;  // reservation stations in use, summed over cycles
+    u_int64_t lbOccupancy = 0;  // load buffer entries in use, summed over cycles
+    u_int64_t flushes = 0;     // pipeline flushes (mispredicted branches and load values)
+    u_int64_t squashed = 0;    // ROB and isq entries thrown away by them
+    u_int64_t activity[kEnergyEvents] = {}; // structure accesses for the energy model
+    u_int64_t ftqBlocks = 0;   // fetch blocks predicted
+    u_int64_t ftqOccupancy = 0; // FTQ blocks waiting, summed over cycles
+    u_int64_t frontendBubbles = 0; // cycles fetch had isq room but nothing to fetch
+    u_int64_t backendStalls = 0;   // cycles fetch was held up by a full isq
+    u_int64_t resteers = 0;    // fetch found the predicted path wrong (code changed)
+    u_int64_t valueLoads = 0;   // retired loads, with --value-predict
+    u_int64_t valueCorrect = 0; // of them, predicted right
+    u_int64_t valueReplays = 0; // predicted wrong: younger instructions refetched
+    u_int64_t loopHits = 0;    // fetches served by the loop buffer
+    u_int64_t fetchReads = 0;  // fetches that read memory and decoded
+    u_int64_t loops = 0;       // loops captured by the loop buffer
+    u_int64_t dcacheAccesses = 0; // loads that went to memory, with --miss-latency
+    u_int64_t dcacheMisses = 0;   // of them, lines neither cached nor on their way
+    u_int64_t prefetchIssued = 0;
+    u_int64_t prefetchUseful = 0; // prefetched lines hit before eviction
+    u_int64_t prefetchLate = 0;   // prefetched lines a load waited for
+    u_int64_t prefetchUnused = 0; // prefetched lines evicted without a hit
+};
+
+thread_local Statistics stats; // of the core simulated on this thread
+
+#endif //RISC_V_STATS_H
@@ -0,0 +1,75 @@
+#ifndef RISC_V_TRACE_H
+#define RISC_V_TRACE_H
+
+#include <string>
+#include "decode.h"
+#include "utils.h"
+#include "writer.h"
+
+// Per-instruction pipeline timeline in the Kanata format (Konata viewer).
+// Every instruction that enters the isq gets a sequence number; each stage
+// transition opens a new stage on lane 0, stamped with the core's Clock:
+//   F   waiting in the isq         Is  issued, waiting for operands
+//   X   executing / address calc   M   load accessing memory
+//   Wb  result on the CDB          Cm  store/atomic performing at commit
+// and the instruction ends either retired or squashed by a flush.
+class PipelineTracer {
+    BufferedWriter out_;
+    const int *clock_ = nullptr;
+    int hart_ = 0;
+    int cycle_ = 0;          // Clock of the last record
+    u_int64_t next_ = 0;     // next sequence number
+    u_int64_t retired_ = 0;
+
+public:
+    bool Open(const std::string &path, int hart, const int *clock) {
+        if (!out_.Open(path)) return false;
+        clock_ = clock;
+        hart_ = hart;
+        cycle_ = *clock;
+        out_ << "Kanata\t0004\nC=\t" << cycle_ << '\n';
+        return true;
+    }
+
+    // A fetched instruction; returns its sequence number.
+    u_int64_t Fetch(u_int32_t pc, u_int32_t order) {
+        Decode decoder;
+        decoder.SetOrder(order);
+        decoder.decode();
+        Sync();
+        u_int64_t seq = next_++;
+        out_ << "I\t" << seq << '\t' << seq << '\t' << hart_ << '\n';
+        out_ << "L\t" << seq << "\t0\t";
+        out_.Hex(pc) << ": ";
+        out_.Hex(order) << ' ' << kOrderName[decoder.op_] << '\n';
+        Stage(seq, "F");
+        return seq;
+    }
+
+    void Stage(u_int64_t seq, const char *stage) {
+        Sync();
+        out_ << "S\t" << seq << "\t0\t" << stage << '\n';
+    }
+
+    void Retire(u_int64_t seq) {
+        Sync();
+        out_ << "R\t" << seq << '\t' << retired_++ << "\t0\n";
+    }
+
+    void Squash(u_int64_t seq) {
+        Sync();
+        out_ << "R\t" << seq << "\t0\t1\n";
+    }
+
+private:
+    void Sync() {
+        if (*clock_ == cycle_) return;
+        out_ << "C\t" << *clock_ - cycle_ << '\n';
+        cycle_ = *clock_;
+    }
+};
+
+std::string TracePath;                       // --trace; hart h > 0 writes TracePath.h
+thread_local PipelineTracer *tracer = nullptr; // this thread's core, when tracing
+
+#endif //RISC_V_TRACE_H
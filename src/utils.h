@@ -19,34 +19,62 @@ enum RV32I_Order {
     ADDI, SLTI, SLTIU, XORI, ORI, ANDI, SLLI, SRLI, SRAI,
 
     ADD, SUB, SLL, SLT, SLTU, XOR, SRL, SRA, OR, AND,
+
+    LR_W, SC_W, AMOSWAP_W, AMOADD_W, AMOXOR_W, AMOAND_W, AMOOR_W,
+    AMOMIN_W, AMOMAX_W, AMOMINU_W, AMOMAXU_W,
+
+    SH1ADD, SH2ADD, SH3ADD, // internal: fused slli + add
+};
+
+static const char *const kOrderName[] = {
+        "nope",
+        "lui", "auipc",
+        "jal", "jalr",
+        "beq", "bne", "blt", "bge", "bltu", "bgeu",
+        "lb", "lh", "lw", "lbu", "lhu",
+        "sb", "sh", "sw",
+        "addi", "slti", "sltiu", "xori", "ori", "andi", "slli", "srli", "srai",
+        "add", "sub", "sll", "slt", "sltu", "xor", "srl", "sra", "or", "and",
+        "lr.w", "sc.w", "amoswap.w", "amoadd.w", "amoxor.w", "amoand.w", "amoor.w",
+        "amomin.w", "amomax.w", "amominu.w", "amomaxu.w",
+        "sh1add", "sh2add", "sh3add",
 };
 
+// Ring buffer of up to `size` elements; Resize() lowers the capacity at run
+// time (both must be powers of two).
 template <typename T, int size = 32>
 class Queue{
+    static_assert((size&(size-1))==0,"Queue size must be a power of two");
 public:
     int len;
     int head,tail;
+    int cap;
     T data[size];
 
-    Queue():len(0),head(0),tail(0){}
+    constexpr Queue():len(0),head(0),tail(0),cap(size),data(){}
+
+    void Resize(int n){
+        cap=n;
+        clear();
+    }
 
     bool ifEmpty(){
         return len==0;
     }
 
     bool ifFull(){
-        return len==size;
+        return len==cap;
     }
 
     void enQueue(T value){
-        if(tail==size) tail=0;
+        if(tail==cap) tail=0;
         data[tail]=value;
         ++tail;
         ++len;
     }
 
     void deQueue(){
-        if(head==size-1) head=0;
+        if(head==cap-1) head=0;
         else ++head;
         --len;
     }
@@ -56,13 +84,72 @@ public:
     }
 
     T& operator [] (int id) {
-        return data[(id+head)%size];
+        return data[(id+head)&(cap-1)];
     }
 
     T& getVal(int id){
-        return data[(id-1)%size];
+        return data[(id-1)&(cap-1)];
     }
 };
 
+// Fixed-capacity bit set, one bit per station tag. Lookups go a 64-bit word
+// at a time, so finding the oldest ready entry does not scan the stations.
+template <int size>
+class BitSet{
+    static const int kWords=(size+63)/64;
+    u_int64_t word_[kWords];
+public:
+    constexpr BitSet():word_(){}
+
+    void set(int i){ word_[i>>6]|=1ull<<(i&63); }
+
+    void reset(int i){ word_[i>>6]&=~(1ull<<(i&63)); }
+
+    bool test(int i) const{ return word_[i>>6]>>(i&63)&1; }
+
+    bool any() const{
+        for(int w=0;w<kWords;++w) if(word_[w]) return true;
+        return false;
+    }
+
+    void clear(){
+        for(int w=0;w<kWords;++w) word_[w]=0;
+    }
+
+    // Lowest set bit at or above i, -1 if none:
+    //   for(int i=s.next(0);i>=0;i=s.next(i+1))
+    int next(int i) const{
+        if(i>=size) return -1;
+        int w=i>>6;
+        u_int64_t x=word_[w]&(~0ull<<(i&63));
+        while(!x){
+            if(++w==kWords) return -1;
+            x=word_[w];
+        }
+        return w*64+__builtin_ctzll(x);
+    }
+};
+
+// Stack of free station tags. Fixed capacity and constexpr-constructible,
+// so per-core (thread_local) stations need no dynamic initialization.
+template <int size>
+class TagStack{
+    int tag_[size];
+    int len_;
+public:
+    constexpr TagStack():tag_(),len_(0){}
+
+    bool empty() const{ return len_==0; }
+
+    int back() const{ return tag_[len_-1]; }
+
+    constexpr void push_back(int tag){ tag_[len_++]=tag; }
+
+    void pop_back(){ --len_; }
+
+    int count() const{ return len_; }
+
+    void clear(){ len_=0; }
+};
 
 #endif //RISC_V_UTILS_H
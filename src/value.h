@@ -0,0 +1,82 @@
+#ifndef RISC_V_VALUE_H
+#define RISC_V_VALUE_H
+
+#include <algorithm>
+#include "utils.h"
+
+enum ValuePredictMode {
+    kValueOff = 0,
+    kValueLast,  // the value the load returned last time
+    kValueStride // last value plus the difference between the last two
+};
+
+// Load value prediction (--value-predict, --value-confidence), shared by
+// all cores.
+struct ValuePredictConfig {
+    int mode = kValueOff;
+    int threshold = 5; // confidence (0..7) a load needs to be predicted
+} valueConfig;
+
+// Load value predictor indexed by load PC. Each entry keeps the last
+// retired value, the stride between the last two and a confidence that
+// every retirement matching the entry's guess raises and any other resets.
+// Loads are predicted at issue once confident; with strides the guess
+// moves one stride further for every older instance still in flight.
+class LoadValuePredictor {
+public:
+    static const int kEntries = 256;
+    static const int kMaxConfidence = 7;
+
+private:
+    struct Entry {
+        u_int32_t pc = 0;
+        u_int32_t last = 0;
+        u_int32_t stride = 0;
+        int confidence = 0;
+        int inflight = 0; // issued, not yet retired or squashed
+    };
+
+    Entry entry_[kEntries];
+
+public:
+    constexpr LoadValuePredictor() : entry_() {}
+
+    void Reset() {
+        for (auto &e: entry_) e = Entry();
+    }
+
+    // The load at pc issues; true with its predicted value if confident.
+    bool Predict(u_int32_t pc, u_int32_t &value) {
+        Entry &e = entry_[(pc >> 2) % kEntries];
+        if (e.pc != pc) {
+            e = Entry();
+            e.pc = pc;
+        }
+        ++e.inflight;
+        if (e.confidence < valueConfig.threshold) return false;
+        value = e.last + (valueConfig.mode == kValueStride ? e.stride * e.inflight : 0);
+        return true;
+    }
+
+    // The oldest in-flight load at pc retired with value.
+    void Train(u_int32_t pc, u_int32_t value) {
+        Entry &e = entry_[(pc >> 2) % kEntries];
+        if (e.pc != pc) return;
+        if (e.inflight) --e.inflight;
+        u_int32_t guess = e.last + (valueConfig.mode == kValueStride ? e.stride : 0);
+        e.confidence = value == guess ? std::min(e.confidence + 1, kMaxConfidence) : 0;
+        e.stride = value - e.last;
+        e.last = value;
+    }
+
+    // Every load in flight was squashed.
+    void Flush() {
+        for (auto &e: entry_) e.inflight = 0;
+    }
+};
+
+const int LoadValuePredictor::kMaxConfidence; // bound to references by std::min and operator<<
+
+thread_local LoadValuePredictor valuePredictor; // this thread's core
+
+#endif //RISC_V_VALUE_H
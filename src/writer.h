@@ -0,0 +1,141 @@
+#ifndef RISC_V_WRITER_H
+#define RISC_V_WRITER_H
+
+#include <condition_variable>
+#include <cstdio>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Text output for large logs. Everything is formatted into one fixed buffer
+// that goes to the file in 1 MiB chunks, so memory stays flat however long
+// the log gets and the cost is a handful of syscalls per megabyte.
+// Opened async, a full buffer is handed to a writer thread and formatting
+// goes on in a second one, so the simulation only waits when the disk
+// falls a whole buffer behind.
+class BufferedWriter {
+public:
+    static const size_t kBufferSize = 1 << 20;
+
+private:
+    FILE *file_ = nullptr;
+    std::vector<char> buf_;
+    size_t len_ = 0;
+
+    // async mode: spare_ holds pending_ bytes being written by thread_
+    std::thread thread_;
+    std::mutex lock_;
+    std::condition_variable wake_;
+    std::vector<char> spare_;
+    size_t pending_ = 0;
+    bool closing_ = false;
+
+public:
+    ~BufferedWriter() { Close(); }
+
+    bool Open(const std::string &path, bool async = false) {
+        Close();
+        file_ = fopen(path.c_str(), "w");
+        buf_.resize(kBufferSize);
+        len_ = 0;
+        if (!file_) return false;
+        if (async) {
+            spare_.resize(kBufferSize);
+            closing_ = false;
+            thread_ = std::thread(&BufferedWriter::Drain, this);
+        }
+        return true;
+    }
+
+    void Close() {
+        if (!file_) return;
+        Flush();
+        if (thread_.joinable()) {
+            {
+                std::lock_guard<std::mutex> guard(lock_);
+                closing_ = true;
+            }
+            wake_.notify_all();
+            thread_.join();
+        }
+        fclose(file_);
+        file_ = nullptr;
+    }
+
+    void Flush() {
+        if (!len_) return;
+        if (!thread_.joinable()) {
+            fwrite(buf_.data(), 1, len_, file_);
+            len_ = 0;
+            return;
+        }
+        std::unique_lock<std::mutex> guard(lock_);
+        wake_.wait(guard, [this] { return !pending_; });
+        buf_.swap(spare_);
+        pending_ = len_;
+        len_ = 0;
+        guard.unlock();
+        wake_.notify_all();
+    }
+
+    BufferedWriter &operator<<(char c) {
+        if (len_ == kBufferSize) Flush();
+        buf_[len_++] = c;
+        return *this;
+    }
+
+    BufferedWriter &operator<<(const char *s) {
+        while (*s) *this << *s++;
+        return *this;
+    }
+
+    BufferedWriter &operator<<(u_int64_t v) {
+        char digits[20];
+        int n = 0;
+        do digits[n++] = '0' + v % 10; while (v /= 10);
+        while (n) *this << digits[--n];
+        return *this;
+    }
+
+    BufferedWriter &operator<<(int v) {
+        if (v < 0) return *this << '-' << (u_int64_t) -(int64_t) v;
+        return *this << (u_int64_t) v;
+    }
+
+    // v >= 0 with `digits` decimals.
+    BufferedWriter &Fixed(double v, int digits) {
+        u_int64_t scale = 1;
+        for (int i = 0; i < digits; ++i) scale *= 10;
+        u_int64_t n = (u_int64_t) (v * scale + 0.5);
+        *this << n / scale;
+        if (!digits) return *this;
+        *this << '.';
+        for (u_int64_t d = scale / 10; d; d /= 10) *this << (char) ('0' + n / d % 10);
+        return *this;
+    }
+
+    // v as `width` lower-case hex digits.
+    BufferedWriter &Hex(u_int32_t v, int width = 8) {
+        for (int shift = 4 * (width - 1); shift >= 0; shift -= 4) *this << "0123456789abcdef"[v >> shift & 15];
+        return *this;
+    }
+
+private:
+    void Drain() {
+        std::unique_lock<std::mutex> guard(lock_);
+        for (;;) {
+            wake_.wait(guard, [this] { return pending_ || closing_; });
+            if (!pending_) return;
+            size_t len = pending_;
+            guard.unlock();
+            fwrite(spare_.data(), 1, len, file_);
+            guard.lock();
+            pending_ = 0;
+            wake_.notify_all();
+        }
+    }
+};
+
+#endif //RISC_V_WRITER_H